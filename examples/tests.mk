@@ -16,7 +16,10 @@ examples/bigxml-xsd
 
 QUICK_TESTS =\
 examples/c14n-default-attr\
+examples/c14n-digest\
+examples/c14n-namespaces\
 examples/c14n-newlines\
+examples/c14n-subset-ns\
 examples/c14n1\
 examples/c14n2\
 examples/command-help\
@@ -35,22 +38,35 @@ examples/ed-backref-delete\
 examples/ed-backref1\
 examples/ed-backref2\
 examples/ed-expr\
+examples/ed-fused\
 examples/ed-insert\
+examples/ed-insert-xml\
 examples/ed-literal\
 examples/ed-move\
 examples/ed-namespace\
 examples/ed-nop\
+examples/ed-patch-out\
 examples/ed-subnode\
+examples/ed-variant\
+examples/ed-xupdate\
 examples/elem1\
 examples/elem2\
 examples/elem3\
 examples/elem-depth\
+examples/elem-infer\
+examples/elem-pattern\
+examples/elem-stats\
 examples/elem-uniq\
+examples/elem-uniq-files\
 examples/escape1\
 examples/exslt-ed\
 examples/exslt1\
 examples/external-entity\
 examples/findfile1\
+examples/format-check\
+examples/format-files\
+examples/format-minify\
+examples/format-mixed\
 examples/genxml1\
 examples/hello1\
 examples/localname1\
@@ -86,6 +102,15 @@ examples/table3\
 examples/unicode1\
 examples/update-attr1\
 examples/update-elem1\
+examples/val-cache\
+examples/val-dtd-cond\
+examples/val-dtd-entities\
+examples/val-dtd-prefixed\
+examples/val-embed-shared\
+examples/val-record-parallel\
+examples/val-report\
+examples/val-schema-map\
+examples/val-split-parallel\
 examples/valid1\
 examples/xinclude1\
 examples/xsl-param1\
@@ -99,7 +124,6 @@ qcheck :
 	@$(MAKE) TESTS="$(QUICK_TESTS)" check
 
 XFAIL_TESTS =\
-examples/bigxml-dtd\
 examples/ed-namespace
 
 if !HAVE_EXSLT_XPATH_REGISTER
@@ -0,0 +1,605 @@
+/*
+
+XMLStarlet: Command Line Toolkit to query/edit/check/transform XML documents
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/xmlmemory.h>
+#include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/uri.h>
+
+#include "c14nstream.h"
+
+/*
+ * The rules are those of libxml2's c14n.c for a document without a node
+ * subset, taken over event by event: attributes are sorted per element,
+ * and what it finds by walking up the tree is kept on two stacks, the
+ * namespace declarations in scope and, for exclusive canonicalization,
+ * the namespaces already rendered.
+ */
+
+typedef enum {
+    C14N_BEFORE_ROOT = 0,
+    C14N_IN_ROOT,
+    C14N_AFTER_ROOT
+} c14nPos;
+
+typedef enum {
+    C14N_TEXT,
+    C14N_ATTR,
+    C14N_PI                     /* also comments */
+} c14nEscape;
+
+typedef struct _c14nNs {
+    const xmlChar *prefix;      /* NULL for the default namespace */
+    const xmlChar *href;
+} c14nNs;
+
+typedef struct _c14nAttr {
+    const xmlChar *name;        /* prefix:name when the prefix is unbound */
+    const xmlChar *prefix;
+    const xmlChar *href;        /* NULL outside of a namespace */
+    const xmlChar *value;
+    int len;
+} c14nAttr;
+
+typedef struct _c14nLevel {
+    int ndecls;                 /* stack heights when the element opened */
+    int nrendered;
+} c14nLevel;
+
+typedef struct _c14nWriter {
+    xmlOutputBufferPtr out;
+    int exclusive;
+    int comments;
+    c14nPos pos;
+    c14nNs *decls;              /* namespace declarations in scope */
+    int ndecls, declsSize;
+    c14nNs *rendered;           /* exclusive: namespaces rendered in scope */
+    int nrendered, renderedSize;
+    c14nLevel *levels;          /* per open element */
+    int depth, levelsSize;
+    c14nNs *list;               /* declarations to write on an element */
+    int listSize;
+    c14nAttr *attrs;
+    int attrsSize;
+    const char *error;          /* set once there is no canonical form */
+    xmlChar *what;              /* what the error is about */
+    int nomem;
+} c14nWriter;
+
+/**
+ *  room for @need items of @size bytes in *@tab
+ */
+static int
+c14nGrow(void *tab, int *tabSize, int need, size_t size)
+{
+    void **p = tab;
+    void *grown;
+    int n = (*tabSize > 0) ? *tabSize : 16;
+
+    if (need <= *tabSize) return 0;
+    while (n < need) n *= 2;
+    grown = xmlRealloc(*p, n * size);
+    if (grown == NULL) return -1;
+    *p = grown;
+    *tabSize = n;
+    return 0;
+}
+
+/**
+ *  NULL and "" are the same string here, as in xmlC14NStrEqual()
+ */
+static int
+c14nStrEqual(const xmlChar *a, const xmlChar *b)
+{
+    return xmlStrEqual(a ? a : BAD_CAST "", b ? b : BAD_CAST "");
+}
+
+static int
+c14nIsXmlNs(const xmlChar *prefix, const xmlChar *href)
+{
+    return xmlStrEqual(prefix, BAD_CAST "xml") &&
+        xmlStrEqual(href, XML_XML_NAMESPACE);
+}
+
+/**
+ *  write [@s, @s + @len) with the references canonical XML asks for
+ */
+static void
+c14nWriteEscaped(xmlOutputBufferPtr out, const xmlChar *s, int len,
+    c14nEscape escape)
+{
+    const xmlChar *end = s + len, *base = s;
+
+    for (; s < end; s++) {
+        const char *ref;
+
+        switch (*s) {
+        case '\r': ref = "&#xD;"; break;
+        case '&': ref = (escape != C14N_PI) ? "&amp;" : NULL; break;
+        case '<': ref = (escape != C14N_PI) ? "&lt;" : NULL; break;
+        case '>': ref = (escape == C14N_TEXT) ? "&gt;" : NULL; break;
+        case '"': ref = (escape == C14N_ATTR) ? "&quot;" : NULL; break;
+        case '\t': ref = (escape == C14N_ATTR) ? "&#x9;" : NULL; break;
+        case '\n': ref = (escape == C14N_ATTR) ? "&#xA;" : NULL; break;
+        default: ref = NULL;
+        }
+        if (ref == NULL) continue;
+        if (s > base) xmlOutputBufferWrite(out, s - base, (const char *) base);
+        xmlOutputBufferWriteString(out, ref);
+        base = s + 1;
+    }
+    if (s > base) xmlOutputBufferWrite(out, s - base, (const char *) base);
+}
+
+static void
+c14nWriteString(c14nWriter *w, const xmlChar *s, c14nEscape escape)
+{
+    if (s != NULL) c14nWriteEscaped(w->out, s, xmlStrlen(s), escape);
+}
+
+/**
+ *  a namespace declaration, its value quoted as xmlBufWriteQuotedString()
+ *  does
+ */
+static void
+c14nWriteNs(c14nWriter *w, const c14nNs *ns)
+{
+    const xmlChar *href = ns->href ? ns->href : BAD_CAST "";
+
+    if (ns->prefix != NULL) {
+        xmlOutputBufferWriteString(w->out, " xmlns:");
+        xmlOutputBufferWriteString(w->out, (const char *) ns->prefix);
+        xmlOutputBufferWriteString(w->out, "=");
+    } else {
+        xmlOutputBufferWriteString(w->out, " xmlns=");
+    }
+    if (xmlStrchr(href, '"') == NULL) {
+        xmlOutputBufferWriteString(w->out, "\"");
+        xmlOutputBufferWriteString(w->out, (const char *) href);
+        xmlOutputBufferWriteString(w->out, "\"");
+    } else if (xmlStrchr(href, '\'') == NULL) {
+        xmlOutputBufferWriteString(w->out, "'");
+        xmlOutputBufferWriteString(w->out, (const char *) href);
+        xmlOutputBufferWriteString(w->out, "'");
+    } else {
+        const xmlChar *base = href;
+
+        xmlOutputBufferWriteString(w->out, "\"");
+        for (; *href; href++) {
+            if (*href != '"') continue;
+            xmlOutputBufferWrite(w->out, href - base, (const char *) base);
+            xmlOutputBufferWriteString(w->out, "&quot;");
+            base = href + 1;
+        }
+        xmlOutputBufferWriteString(w->out, (const char *) base);
+        xmlOutputBufferWriteString(w->out, "\"");
+    }
+}
+
+/**
+ *  sort order of namespace declarations: by prefix, the default first
+ */
+static int
+c14nNsCompare(const void *a, const void *b)
+{
+    return xmlStrcmp(((const c14nNs *) a)->prefix,
+        ((const c14nNs *) b)->prefix);
+}
+
+/**
+ *  sort order of attributes: those outside of a namespace first, by name,
+ *  then by namespace URI and name
+ */
+static int
+c14nAttrCompare(const void *a, const void *b)
+{
+    const c14nAttr *a1 = a, *a2 = b;
+    int ret;
+
+    if (a1->href == NULL || a2->href == NULL) {
+        if (a1->href != NULL) return 1;
+        if (a2->href != NULL) return -1;
+        return xmlStrcmp(a1->name, a2->name);
+    }
+    ret = xmlStrcmp(a1->href, a2->href);
+    return (ret != 0) ? ret : xmlStrcmp(a1->name, a2->name);
+}
+
+/**
+ *  the nearest declaration of @prefix below stack height @top, or NULL
+ */
+static const c14nNs *
+c14nLookup(const c14nNs *tab, int top, const xmlChar *prefix)
+{
+    while (--top >= 0) {
+        if (c14nStrEqual(tab[top].prefix, prefix)) return &tab[top];
+    }
+    return NULL;
+}
+
+/**
+ *  whether (@prefix, @href) is already what the output has in scope,
+ *  going by @tab below height @top
+ */
+static int
+c14nInScope(const c14nNs *tab, int top, const xmlChar *prefix,
+    const xmlChar *href)
+{
+    const c14nNs *ns = c14nLookup(tab, top, prefix);
+
+    if (ns != NULL) return c14nStrEqual(ns->href, href);
+    return c14nStrEqual(prefix, NULL) && c14nStrEqual(href, NULL);
+}
+
+static int
+c14nPush(c14nNs **tab, int *n, int *size, const xmlChar *prefix,
+    const xmlChar *href)
+{
+    if (c14nGrow(tab, size, *n + 1, sizeof(c14nNs)) != 0) return -1;
+    (*tab)[*n].prefix = prefix;
+    (*tab)[*n].href = href;
+    (*n)++;
+    return 0;
+}
+
+/**
+ *  remember why there is no canonical form; nothing is written after that
+ */
+static void
+c14nFail(c14nWriter *w, const char *error, const xmlChar *what)
+{
+    w->error = error;
+    w->what = xmlStrdup(what);
+}
+
+/**
+ *  a namespace URI must be absolute
+ */
+static int
+c14nCheckUri(c14nWriter *w, const xmlChar *href)
+{
+    xmlURIPtr uri;
+
+    if (xmlStrlen(href) == 0) return 0;
+    uri = xmlParseURI((const char *) href);
+    if (uri == NULL) {
+        c14nFail(w, "Invalid namespace URI : %s\n", href);
+        return -1;
+    }
+    if (xmlStrlen((const xmlChar *) uri->scheme) == 0) {
+        c14nFail(w, "Relative namespace URI is invalid here : %s\n", href);
+        xmlFreeURI(uri);
+        return -1;
+    }
+    xmlFreeURI(uri);
+    return 0;
+}
+
+/**
+ *  the namespace declarations of the new element: those of its own that
+ *  differ from its parent's, or for exclusive canonicalization, the ones
+ *  it and its attributes use that are not in scope in the output yet
+ */
+static int
+c14nNamespaces(c14nWriter *w, const xmlChar *prefix, const xmlChar *URI,
+    int nattrs, int *nlist)
+{
+    const c14nLevel *level = &w->levels[w->depth - 1];
+    int i, n = 0, emptyNs = 0, emptyUsed = 0;
+
+    if (!w->exclusive) {
+        for (i = level->ndecls; i < w->ndecls; i++) {
+            const c14nNs *ns = &w->decls[i];
+
+            if (c14nIsXmlNs(ns->prefix, ns->href) ||
+                c14nInScope(w->decls, level->ndecls, ns->prefix, ns->href))
+                continue;
+            w->list[n++] = *ns;
+        }
+        *nlist = n;
+        return 0;
+    }
+
+    if (URI == NULL) {
+        const c14nNs *def = c14nLookup(w->decls, w->ndecls, NULL);
+
+        emptyUsed = 1;
+        if (def != NULL) {
+            prefix = NULL;
+            URI = def->href;
+        }
+    }
+    if (URI != NULL && !c14nIsXmlNs(prefix, URI)) {
+        if (!c14nInScope(w->rendered, w->nrendered, prefix, URI)) {
+            w->list[n].prefix = prefix;
+            w->list[n++].href = URI;
+        }
+        if (c14nPush(&w->rendered, &w->nrendered, &w->renderedSize,
+                prefix, URI) != 0)
+            return -1;
+        if (xmlStrlen(prefix) == 0) emptyNs = 1;
+    }
+    for (i = 0; i < nattrs; i++) {
+        const c14nAttr *attr = &w->attrs[i];
+        int done;
+
+        if (attr->href == NULL || c14nIsXmlNs(attr->prefix, attr->href))
+            continue;
+        done = c14nInScope(w->rendered, w->nrendered, attr->prefix,
+            attr->href);
+        if (c14nPush(&w->rendered, &w->nrendered, &w->renderedSize,
+                attr->prefix, attr->href) != 0)
+            return -1;
+        if (!done) w->list[n++] = w->rendered[w->nrendered - 1];
+    }
+    /* xmlns="" undoes a default namespace of an ancestor in the output */
+    if (emptyUsed && !emptyNs &&
+        !c14nInScope(w->rendered, w->nrendered, NULL, NULL)) {
+        w->list[n].prefix = NULL;
+        w->list[n++].href = BAD_CAST "";
+    }
+    *nlist = n;
+    return 0;
+}
+
+static void
+c14nStartElementNs(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI, int nb_namespaces,
+    const xmlChar **namespaces, int nb_attributes, int nb_defaulted,
+    const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+    c14nLevel *level;
+    int i, nlist;
+
+    if (w->error != NULL || w->nomem) return;
+    if ((ctxt->loadsubset & XML_COMPLETE_ATTRS) == 0)
+        nb_attributes -= nb_defaulted;
+    if (c14nGrow(&w->levels, &w->levelsSize, w->depth + 1,
+            sizeof(c14nLevel)) != 0 ||
+        c14nGrow(&w->attrs, &w->attrsSize, nb_attributes,
+            sizeof(c14nAttr)) != 0 ||
+        c14nGrow(&w->list, &w->listSize, nb_namespaces + nb_attributes + 2,
+            sizeof(c14nNs)) != 0)
+        goto nomem;
+    level = &w->levels[w->depth++];
+    level->ndecls = w->ndecls;
+    level->nrendered = w->nrendered;
+
+    for (i = 0; i < nb_namespaces; i++) {
+        if (c14nCheckUri(w, namespaces[2 * i + 1]) != 0) return;
+        if (c14nPush(&w->decls, &w->ndecls, &w->declsSize,
+                namespaces[2 * i], namespaces[2 * i + 1]) != 0)
+            goto nomem;
+    }
+    for (i = 0; i < nb_attributes; i++) {
+        const xmlChar **att = &attributes[5 * i];
+        c14nAttr *attr = &w->attrs[i];
+
+        attr->name = att[0];
+        attr->prefix = att[1];
+        attr->href = att[2];
+        if (att[1] != NULL && att[2] == NULL)
+            attr->name = xmlDictQLookup(ctxt->dict, att[1], att[0]);
+        attr->value = att[3];
+        attr->len = att[4] - att[3];
+    }
+    if (c14nNamespaces(w, prefix, URI, nb_attributes, &nlist) != 0)
+        goto nomem;
+
+    if (w->pos == C14N_BEFORE_ROOT && w->depth == 1) w->pos = C14N_IN_ROOT;
+    xmlOutputBufferWriteString(w->out, "<");
+    if (xmlStrlen(prefix) > 0) {
+        xmlOutputBufferWriteString(w->out, (const char *) prefix);
+        xmlOutputBufferWriteString(w->out, ":");
+    }
+    xmlOutputBufferWriteString(w->out, (const char *) localname);
+    /* with less than two there is nothing to sort, maybe no array */
+    if (nlist > 1)
+        qsort(w->list, nlist, sizeof(c14nNs), c14nNsCompare);
+    for (i = 0; i < nlist; i++)
+        c14nWriteNs(w, &w->list[i]);
+    if (nb_attributes > 1)
+        qsort(w->attrs, nb_attributes, sizeof(c14nAttr), c14nAttrCompare);
+    for (i = 0; i < nb_attributes; i++) {
+        const c14nAttr *attr = &w->attrs[i];
+
+        xmlOutputBufferWriteString(w->out, " ");
+        if (attr->href != NULL && xmlStrlen(attr->prefix) > 0) {
+            xmlOutputBufferWriteString(w->out, (const char *) attr->prefix);
+            xmlOutputBufferWriteString(w->out, ":");
+        }
+        xmlOutputBufferWriteString(w->out, (const char *) attr->name);
+        xmlOutputBufferWriteString(w->out, "=\"");
+        c14nWriteEscaped(w->out, attr->value, attr->len, C14N_ATTR);
+        xmlOutputBufferWriteString(w->out, "\"");
+    }
+    xmlOutputBufferWriteString(w->out, ">");
+    return;
+
+nomem:
+    w->nomem = 1;
+    xmlStopParser(ctxt);
+}
+
+static void
+c14nEndElementNs(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+    const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+    c14nLevel *level;
+
+    if (w->error != NULL || w->nomem) return;
+    level = &w->levels[--w->depth];
+    w->ndecls = level->ndecls;
+    w->nrendered = level->nrendered;
+
+    xmlOutputBufferWriteString(w->out, "</");
+    if (xmlStrlen(prefix) > 0) {
+        xmlOutputBufferWriteString(w->out, (const char *) prefix);
+        xmlOutputBufferWriteString(w->out, ":");
+    }
+    xmlOutputBufferWriteString(w->out, (const char *) localname);
+    xmlOutputBufferWriteString(w->out, ">");
+    if (w->depth == 0) w->pos = C14N_AFTER_ROOT;
+}
+
+static void
+c14nCharacters(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+
+    if (w->error != NULL || w->nomem || w->depth == 0) return;
+    c14nWriteEscaped(w->out, ch, len, C14N_TEXT);
+}
+
+/**
+ *  a comment or PI outside of the document element goes on a line of its
+ *  own
+ */
+static void
+c14nMisc(c14nWriter *w, const char *open, const xmlChar *target,
+    const xmlChar *content, const char *close)
+{
+    if (w->pos == C14N_AFTER_ROOT)
+        xmlOutputBufferWriteString(w->out, "\n");
+    xmlOutputBufferWriteString(w->out, open);
+    if (target != NULL) {
+        xmlOutputBufferWriteString(w->out, (const char *) target);
+        if (xmlStrlen(content) > 0) xmlOutputBufferWriteString(w->out, " ");
+    }
+    c14nWriteString(w, content, C14N_PI);
+    xmlOutputBufferWriteString(w->out, close);
+    if (w->pos == C14N_BEFORE_ROOT)
+        xmlOutputBufferWriteString(w->out, "\n");
+}
+
+static void
+c14nComment(void *ctx, const xmlChar *value)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+
+    if (w->error != NULL || w->nomem || ctxt->inSubset || !w->comments)
+        return;
+    c14nMisc(w, "<!--", NULL, value, "-->");
+}
+
+static void
+c14nProcessingInstruction(void *ctx, const xmlChar *target,
+    const xmlChar *data)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+
+    if (w->error != NULL || w->nomem || ctxt->inSubset) return;
+    c14nMisc(w, "<?", target, data, "?>");
+}
+
+/**
+ *  an entity left unexpanded, because it is not declared
+ */
+static void
+c14nReference(void *ctx, const xmlChar *name)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    c14nWriter *w = ctxt->_private;
+
+    if (w->error != NULL || w->nomem) return;
+    c14nFail(w, "Entity reference to %s is invalid here\n", name);
+}
+
+/**
+ *  canonicalize @filename into @out as it is parsed with @options; what
+ *  was written before an error is left in @out
+ */
+int
+c14nStream(const char *filename, int options, int exclusive,
+    int with_comments, xmlOutputBufferPtr out)
+{
+    xmlParserCtxtPtr ctxt;
+    xmlParserInputPtr input;
+    xmlSAXHandlerPtr sax;
+    c14nWriter w;
+    int ret = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.out = out;
+    w.exclusive = exclusive;
+    w.comments = with_comments;
+
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) return C14N_STREAM_FAILED;
+    xmlCtxtUseOptions(ctxt, options);
+    ctxt->_private = &w;
+    sax = ctxt->sax;
+    sax->startElementNs = c14nStartElementNs;
+    sax->endElementNs = c14nEndElementNs;
+    sax->characters = c14nCharacters;
+    sax->ignorableWhitespace = c14nCharacters;
+    sax->cdataBlock = c14nCharacters;
+    sax->comment = c14nComment;
+    sax->processingInstruction = c14nProcessingInstruction;
+    sax->reference = c14nReference;
+
+    input = xmlLoadExternalEntity(filename, NULL, ctxt);
+    if (input == NULL) {
+        xmlFreeParserCtxt(ctxt);
+        return C14N_STREAM_BAD_FILE;
+    }
+    inputPush(ctxt, input);
+    if (ctxt->directory == NULL)
+        ctxt->directory = xmlParserGetDirectory(filename);
+
+    xmlParseDocument(ctxt);
+
+    if (w.nomem) {
+        xmlGenericError(xmlGenericErrorContext, "out of memory\n");
+        ret = C14N_STREAM_FAILED;
+    } else if (!ctxt->wellFormed) {
+        ret = C14N_STREAM_BAD_FILE;
+    } else if (w.error != NULL) {
+        xmlGenericError(xmlGenericErrorContext, w.error, w.what);
+        ret = C14N_STREAM_FAILED;
+    }
+
+    xmlFree(w.what);
+    xmlFree(w.decls);
+    xmlFree(w.rendered);
+    xmlFree(w.levels);
+    xmlFree(w.list);
+    xmlFree(w.attrs);
+    xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+    xmlFreeParserCtxt(ctxt);
+    return ret;
+}
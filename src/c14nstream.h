@@ -0,0 +1,17 @@
+#ifndef C14NSTREAM_H
+#define C14NSTREAM_H
+
+#include <libxml/xmlIO.h>
+
+/*
+ *  canonical XML of a whole document (C14N 1.0 or exclusive), written
+ *  while it is parsed: memory follows the depth of the tree, not its size
+ */
+
+#define C14N_STREAM_BAD_FILE  -1    /* not well-formed, or not readable */
+#define C14N_STREAM_FAILED    -2    /* no canonical form, e.g. relative URI */
+
+int c14nStream(const char *filename, int options, int exclusive,
+    int with_comments, xmlOutputBufferPtr out);
+
+#endif  /* C14NSTREAM_H */
@@ -0,0 +1,347 @@
+/*
+
+XMLStarlet: Command Line Toolkit to query/edit/check/transform XML documents
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <config.h>
+
+#include <string.h>
+
+#include "digest.h"
+
+/* 64 bit constants without C99 long long literals */
+#define U64(hi, lo) (((uint64_t) (hi) << 32) | (uint64_t) (lo))
+
+#define PRIME64_1 U64(0x9E3779B1, 0x85EBCA87)
+#define PRIME64_2 U64(0xC2B2AE3D, 0x27D4EB4F)
+#define PRIME64_3 U64(0x165667B1, 0x9E3779F9)
+#define PRIME64_4 U64(0x85EBCA77, 0xC2B2AE63)
+#define PRIME64_5 U64(0x27D4EB2F, 0x165667C5)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* read little endian words, whatever the alignment and byte order */
+static uint64_t
+read64(const unsigned char *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 |
+        (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+        (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 |
+        (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint64_t
+read32(const unsigned char *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 |
+        (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24;
+}
+
+static uint64_t
+xxh64Round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t
+xxh64MergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64Round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+void
+xxh64Init(xxh64State *state, uint64_t seed)
+{
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+void
+xxh64Update(xxh64State *state, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+
+    state->total_len += len;
+
+    if (state->mem_size + len < 32) {
+        memcpy(state->mem + state->mem_size, p, len);
+        state->mem_size += len;
+        return;
+    }
+    if (state->mem_size) {
+        memcpy(state->mem + state->mem_size, p, 32 - state->mem_size);
+        p += 32 - state->mem_size;
+        state->v[0] = xxh64Round(state->v[0], read64(state->mem));
+        state->v[1] = xxh64Round(state->v[1], read64(state->mem + 8));
+        state->v[2] = xxh64Round(state->v[2], read64(state->mem + 16));
+        state->v[3] = xxh64Round(state->v[3], read64(state->mem + 24));
+        state->mem_size = 0;
+    }
+    for (; p + 32 <= end; p += 32) {
+        state->v[0] = xxh64Round(state->v[0], read64(p));
+        state->v[1] = xxh64Round(state->v[1], read64(p + 8));
+        state->v[2] = xxh64Round(state->v[2], read64(p + 16));
+        state->v[3] = xxh64Round(state->v[3], read64(p + 24));
+    }
+    if (p < end) {
+        memcpy(state->mem, p, end - p);
+        state->mem_size = end - p;
+    }
+}
+
+uint64_t
+xxh64Final(const xxh64State *state)
+{
+    const unsigned char *p = state->mem;
+    const unsigned char *end = p + state->mem_size;
+    uint64_t h;
+
+    if (state->total_len >= 32) {
+        h = ROTL64(state->v[0], 1) + ROTL64(state->v[1], 7) +
+            ROTL64(state->v[2], 12) + ROTL64(state->v[3], 18);
+        h = xxh64MergeRound(h, state->v[0]);
+        h = xxh64MergeRound(h, state->v[1]);
+        h = xxh64MergeRound(h, state->v[2]);
+        h = xxh64MergeRound(h, state->v[3]);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+    h += state->total_len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64Round(0, read64(p));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+    xxh64State state;
+    xxh64Init(&state, seed);
+    xxh64Update(&state, data, len);
+    return xxh64Final(&state);
+}
+
+#define ROTL32(x, r) ((uint32_t) (((x) << (r)) | ((x) >> (32 - (r)))))
+#define ROTR32(x, r) ((uint32_t) (((x) >> (r)) | ((x) << (32 - (r)))))
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* SHA words are big endian */
+static uint32_t
+readBE32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+        (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static void
+sha1Block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[80], a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i = 0; i < 16; i++) w[i] = readBE32(p + 4 * i);
+    for (; i < 80; i++) w[i] = ROTL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROTL32(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = ROTL32(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void
+sha256Block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) w[i] = readBE32(p + 4 * i);
+    for (; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^
+            (w[i-15] >> 3);
+        uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^
+            (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = k + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+            ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void
+sha1Init(shaState *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->h[0] = 0x67452301;
+    state->h[1] = 0xefcdab89;
+    state->h[2] = 0x98badcfe;
+    state->h[3] = 0x10325476;
+    state->h[4] = 0xc3d2e1f0;
+}
+
+void
+sha256Init(shaState *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->sha256 = 1;
+    state->h[0] = 0x6a09e667;
+    state->h[1] = 0xbb67ae85;
+    state->h[2] = 0x3c6ef372;
+    state->h[3] = 0xa54ff53a;
+    state->h[4] = 0x510e527f;
+    state->h[5] = 0x9b05688c;
+    state->h[6] = 0x1f83d9ab;
+    state->h[7] = 0x5be0cd19;
+}
+
+static void
+shaBlock(shaState *state, const unsigned char *p)
+{
+    if (state->sha256)
+        sha256Block(state->h, p);
+    else
+        sha1Block(state->h, p);
+}
+
+void
+shaUpdate(shaState *state, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+
+    state->total_len += len;
+
+    if (state->mem_size + len < 64) {
+        memcpy(state->mem + state->mem_size, p, len);
+        state->mem_size += len;
+        return;
+    }
+    if (state->mem_size) {
+        memcpy(state->mem + state->mem_size, p, 64 - state->mem_size);
+        p += 64 - state->mem_size;
+        shaBlock(state, state->mem);
+        state->mem_size = 0;
+    }
+    for (; p + 64 <= end; p += 64)
+        shaBlock(state, p);
+    if (p < end) {
+        memcpy(state->mem, p, end - p);
+        state->mem_size = end - p;
+    }
+}
+
+/**
+ *  write the SHA1_SIZE or SHA256_SIZE bytes of the digest to @digest;
+ *  @state is used up
+ */
+void
+shaFinal(shaState *state, unsigned char *digest)
+{
+    uint64_t bits = state->total_len * 8;
+    int i, n = state->sha256 ? 8 : 5;
+
+    state->mem[state->mem_size++] = 0x80;
+    if (state->mem_size > 56) {
+        memset(state->mem + state->mem_size, 0, 64 - state->mem_size);
+        shaBlock(state, state->mem);
+        state->mem_size = 0;
+    }
+    memset(state->mem + state->mem_size, 0, 56 - state->mem_size);
+    for (i = 0; i < 8; i++)
+        state->mem[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+    shaBlock(state, state->mem);
+
+    for (i = 0; i < n; i++) {
+        digest[4 * i] = (unsigned char) (state->h[i] >> 24);
+        digest[4 * i + 1] = (unsigned char) (state->h[i] >> 16);
+        digest[4 * i + 2] = (unsigned char) (state->h[i] >> 8);
+        digest[4 * i + 3] = (unsigned char) state->h[i];
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *  XXH64 (https://github.com/Cyan4973/xxHash), a fast non-cryptographic
+ *  hash; good for recognizing content already seen, not for signatures
+ */
+
+typedef struct _xxh64State {
+    uint64_t total_len;
+    uint64_t v[4];
+    unsigned char mem[32];      /* input not yet consumed by a full stripe */
+    unsigned mem_size;
+    uint64_t seed;
+} xxh64State;
+
+void xxh64Init(xxh64State *state, uint64_t seed);
+void xxh64Update(xxh64State *state, const void *data, size_t len);
+uint64_t xxh64Final(const xxh64State *state);
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+/*
+ *  SHA-1 and SHA-256 (FIPS 180-4), for digests to compare with those of
+ *  other tools
+ */
+
+#define SHA1_SIZE 20
+#define SHA256_SIZE 32
+
+typedef struct _shaState {
+    uint32_t h[8];              /* only 5 are used by SHA-1 */
+    uint64_t total_len;
+    unsigned char mem[64];      /* input not yet consumed by a full block */
+    unsigned mem_size;
+    int sha256;
+} shaState;
+
+void sha1Init(shaState *state);
+void sha256Init(shaState *state);
+void shaUpdate(shaState *state, const void *data, size_t len);
+void shaFinal(shaState *state, unsigned char *digest);
+
+#endif  /* DIGEST_H */
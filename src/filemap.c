@@ -0,0 +1,122 @@
+/*
+
+XMLStarlet: Command Line Toolkit to query/edit/check/transform XML documents
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
+
+#include "filemap.h"
+
+/* fallback for systems without mmap, or files that can't be mapped */
+static int
+fileMapRead(FileMap *map, const char *filename)
+{
+    FILE *f = strcmp(filename, "-")? fopen(filename, "rb") : stdin;
+    char *buf = NULL;
+    size_t size = 0, alloc = 0, n;
+
+    if (!f) return -1;
+    do {
+        if (size == alloc) {
+            char *tmp;
+            alloc = alloc ? alloc * 2 : 64 * 1024;
+            tmp = realloc(buf, alloc);
+            if (!tmp) {
+                free(buf);
+                if (f != stdin) fclose(f);
+                return -1;
+            }
+            buf = tmp;
+        }
+        n = fread(buf + size, 1, alloc - size, f);
+        size += n;
+    } while (n > 0);
+    if (ferror(f)) {
+        free(buf);
+        if (f != stdin) fclose(f);
+        return -1;
+    }
+    if (f != stdin) fclose(f);
+    map->data = buf;
+    map->size = size;
+    map->mapped = 0;
+    return 0;
+}
+
+/**
+ *  Make the content of @filename ("-" for standard input) available in
+ *  @map; returns 0 on success, -1 if the file can't be read
+ */
+int
+fileMapOpen(FileMap *map, const char *filename)
+{
+#ifdef USE_MMAP
+    struct stat st;
+    int fd;
+    void *p;
+
+    if (!strcmp(filename, "-")) return fileMapRead(map, filename);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            map->data = p;
+            map->size = st.st_size;
+            map->mapped = 1;
+            return 0;
+        }
+    }
+    close(fd);
+#endif
+    return fileMapRead(map, filename);
+}
+
+void
+fileMapClose(FileMap *map)
+{
+#ifdef USE_MMAP
+    if (map->mapped) {
+        munmap((void *) map->data, map->size);
+        map->data = NULL;
+        return;
+    }
+#endif
+    free((void *) map->data);
+    map->data = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef FILEMAP_H
+#define FILEMAP_H
+
+#include <stddef.h>
+
+/* read-only view of a whole file, mmapped where the system allows it */
+typedef struct _FileMap {
+    const char *data;
+    size_t size;
+    int mapped;                 /* data came from mmap, not malloc */
+} FileMap;
+
+int fileMapOpen(FileMap *map, const char *filename);
+void fileMapClose(FileMap *map);
+
+#endif  /* FILEMAP_H */
@@ -0,0 +1,728 @@
+/*
+
+XMLStarlet: Command Line Toolkit to query/edit/check/transform XML documents
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/xmlmemory.h>
+#include <libxml/hash.h>
+#include <libxml/parserInternals.h>
+
+#include "infer.h"
+
+/* simple types a value can have; none left means string */
+#define INFER_BOOLEAN   1
+#define INFER_INTEGER   2
+#define INFER_DECIMAL   4
+#define INFER_DATE      8
+#define INFER_DATETIME 16
+#define INFER_ANY      31
+
+#define INFER_VALUE_MAX 64      /* longer text is taken as a string */
+
+typedef struct _InferType InferType;
+
+typedef struct _InferAttr {
+    xmlChar *name;
+    unsigned long count;        /* instances of the element carrying it */
+    int types;
+    int nsDecl;                 /* xmlns or xmlns:* */
+    int qualified;              /* in a namespace, can't be declared here */
+} InferAttr;
+
+typedef struct _InferChild {
+    InferType *type;
+    unsigned long instances;    /* parent instances containing it */
+    unsigned long min, max;     /* occurrences in those instances */
+} InferChild;
+
+struct _InferType {
+    xmlChar *name;              /* as its first instance is prefixed */
+    xmlChar *ns;
+    unsigned long count;        /* instances started */
+    unsigned long ended;        /* instances ended, by what they held: */
+    unsigned long withChildren;
+    unsigned long withText;     /* text only */
+    int mixed;                  /* text next to children */
+    int textTypes;
+    int unordered;              /* a child came back after another one */
+    InferChild *children;       /* in order of appearance */
+    int nchildren, childrenSize;
+    unsigned char *before;      /* [i * childrenSize + j]: i came before j */
+    InferAttr *attrs;
+    int nattrs, attrsSize;
+};
+
+typedef struct _InferRun {
+    int child;
+    unsigned long count;
+} InferRun;
+
+/* an open element */
+typedef struct _InferFrame {
+    InferType *type;
+    int hasText;
+    int hasBlank;               /* text, all of it blank */
+    int textLen;                /* -1 once the text is too long */
+    xmlChar text[INFER_VALUE_MAX];
+    InferRun *runs;             /* its children so far, by first appearance */
+    int nruns, runsSize;
+} InferFrame;
+
+struct _InferModel {
+    xmlHashTablePtr byName;     /* local name, namespace -> InferType */
+    InferType **types;          /* in order of appearance */
+    int ntypes, typesSize;
+    InferFrame *frames;         /* by depth */
+    int framesSize;
+    xmlChar *ns;                /* namespace of the first document element */
+    int haveRoot;
+};
+
+InferModel *
+inferNew(void)
+{
+    InferModel *model = xmlMalloc(sizeof(InferModel));
+    memset(model, 0, sizeof(InferModel));
+    model->byName = xmlHashCreate(0);
+    return model;
+}
+
+void
+inferFree(InferModel *model)
+{
+    int i, j;
+
+    for (i = 0; i < model->ntypes; i++)
+    {
+        InferType *type = model->types[i];
+        for (j = 0; j < type->nattrs; j++)
+            xmlFree(type->attrs[j].name);
+        xmlFree(type->attrs);
+        xmlFree(type->children);
+        xmlFree(type->before);
+        xmlFree(type->name);
+        xmlFree(type->ns);
+        xmlFree(type);
+    }
+    for (i = 0; i < model->framesSize; i++)
+        xmlFree(model->frames[i].runs);
+    xmlFree(model->frames);
+    xmlFree(model->types);
+    xmlFree(model->ns);
+    xmlHashFree(model->byName, NULL);
+    xmlFree(model);
+}
+
+/**
+ *  match @pattern at @p, 'd' standing for a digit; return the end of the
+ *  match or NULL
+ */
+static const xmlChar *
+inferMatch(const xmlChar *p, const xmlChar *end, const char *pattern)
+{
+    for (; *pattern; pattern++, p++)
+    {
+        if (p >= end) return NULL;
+        if (*pattern == 'd'? (*p < '0' || *p > '9') : *p != *pattern)
+            return NULL;
+    }
+    return p;
+}
+
+#define INFER_2DIGITS(p) (((p)[0] - '0') * 10 + (p)[1] - '0')
+
+/**
+ *  return the simple types @value, of @len bytes, is valid for
+ */
+static int
+inferValueTypes(const xmlChar *value, int len)
+{
+    const xmlChar *p, *end;
+    int types = 0, digits = 0, point = 0;
+
+    while (len > 0 && IS_BLANK_CH(*value)) value++, len--;
+    while (len > 0 && IS_BLANK_CH(value[len - 1])) len--;
+    if (len == 0) return 0;
+    end = value + len;
+
+    if ((len == 4 && !memcmp(value, "true", 4)) ||
+        (len == 5 && !memcmp(value, "false", 5)))
+        return INFER_BOOLEAN;
+
+    p = value;
+    if (*p == '+' || *p == '-') p++;
+    for (; p < end; p++)
+    {
+        if (*p >= '0' && *p <= '9') digits++;
+        else if (*p == '.' && !point) point = 1;
+        else break;
+    }
+    if (p == end && digits)
+        types |= point? INFER_DECIMAL : INFER_INTEGER | INFER_DECIMAL;
+
+    p = inferMatch(value, end, "dddd-dd-dd");
+    if (p && INFER_2DIGITS(value + 5) >= 1 && INFER_2DIGITS(value + 5) <= 12
+        && INFER_2DIGITS(value + 8) >= 1 && INFER_2DIGITS(value + 8) <= 31)
+    {
+        const xmlChar *time = p + 1;
+
+        if (p == end)
+            types |= INFER_DATE;
+        else if (*p == 'T' && (p = inferMatch(time, end, "dd:dd:dd")) &&
+                 INFER_2DIGITS(time) < 24 && INFER_2DIGITS(time + 3) < 60 &&
+                 INFER_2DIGITS(time + 6) < 60)
+        {
+            if (p < end && *p == '.' && p + 1 < end &&
+                p[1] >= '0' && p[1] <= '9')
+            {
+                for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+                    ;
+            }
+            if (p < end && *p == 'Z') p++;
+            else if (p < end && (*p == '+' || *p == '-'))
+                p = inferMatch(p + 1, end, "dd:dd");
+            if (p == end) types |= INFER_DATETIME;
+        }
+    }
+    return types;
+}
+
+static const char *
+inferXsdType(int types)
+{
+    if (types & INFER_BOOLEAN) return "xs:boolean";
+    if (types & INFER_INTEGER) return "xs:integer";
+    if (types & INFER_DECIMAL) return "xs:decimal";
+    if (types & INFER_DATE) return "xs:date";
+    if (types & INFER_DATETIME) return "xs:dateTime";
+    return "xs:string";
+}
+
+/**
+ *  find or add child @type of @parent, return its index
+ */
+static int
+inferChildIndex(InferType *parent, InferType *type)
+{
+    int i;
+
+    for (i = 0; i < parent->nchildren; i++)
+        if (parent->children[i].type == type) return i;
+
+    if (parent->nchildren == parent->childrenSize)
+    {
+        int size = parent->childrenSize? parent->childrenSize * 2 : 8;
+        unsigned char *before = xmlMalloc(size * size);
+
+        memset(before, 0, size * size);
+        for (i = 0; i < parent->nchildren; i++)
+            memcpy(before + i * size,
+                parent->before + i * parent->childrenSize, parent->nchildren);
+        xmlFree(parent->before);
+        parent->before = before;
+        parent->children = xmlRealloc(parent->children,
+            size * sizeof(InferChild));
+        parent->childrenSize = size;
+    }
+    i = parent->nchildren++;
+    memset(&parent->children[i], 0, sizeof(InferChild));
+    parent->children[i].type = type;
+    return i;
+}
+
+/**
+ *  count child @type in the open element @frame
+ */
+static void
+inferChild(InferFrame *frame, InferType *type)
+{
+    InferType *parent = frame->type;
+    int i, child;
+
+    if (frame->nruns &&
+        parent->children[frame->runs[frame->nruns - 1].child].type == type)
+    {
+        frame->runs[frame->nruns - 1].count++;
+        return;
+    }
+
+    child = inferChildIndex(parent, type);
+    for (i = 0; i < frame->nruns; i++)
+    {
+        if (frame->runs[i].child == child)
+        {
+            parent->unordered = 1;
+            frame->runs[i].count++;
+            return;
+        }
+    }
+
+    if (frame->nruns == frame->runsSize)
+    {
+        frame->runsSize = frame->runsSize? frame->runsSize * 2 : 8;
+        frame->runs = xmlRealloc(frame->runs,
+            frame->runsSize * sizeof(InferRun));
+    }
+    frame->runs[frame->nruns].child = child;
+    frame->runs[frame->nruns].count = 1;
+    frame->nruns++;
+}
+
+/**
+ *  record the attribute the reader is on for @type
+ */
+static void
+inferAttr(InferType *type, xmlTextReaderPtr reader)
+{
+    const xmlChar *name = xmlTextReaderConstName(reader),
+        *value = xmlTextReaderConstValue(reader);
+    InferAttr *attr = NULL;
+    int i;
+
+    for (i = 0; i < type->nattrs; i++)
+    {
+        if (xmlStrEqual(type->attrs[i].name, name))
+        {
+            attr = &type->attrs[i];
+            break;
+        }
+    }
+    if (!attr)
+    {
+        if (type->nattrs == type->attrsSize)
+        {
+            type->attrsSize = type->attrsSize? type->attrsSize * 2 : 4;
+            type->attrs = xmlRealloc(type->attrs,
+                type->attrsSize * sizeof(InferAttr));
+        }
+        attr = &type->attrs[type->nattrs++];
+        attr->name = xmlStrdup(name);
+        attr->count = 0;
+        attr->types = INFER_ANY;
+        attr->nsDecl = xmlTextReaderIsNamespaceDecl(reader) == 1;
+        attr->qualified = !attr->nsDecl &&
+            xmlTextReaderConstNamespaceUri(reader) != NULL;
+    }
+    attr->count++;
+    attr->types &= inferValueTypes(value, xmlStrlen(value));
+}
+
+/**
+ *  learn from the element the reader is on, at @depth
+ */
+void
+inferElement(InferModel *model, xmlTextReaderPtr reader, int depth)
+{
+    const xmlChar *name = xmlTextReaderConstName(reader);
+    const xmlChar *local = xmlTextReaderConstLocalName(reader);
+    const xmlChar *ns = xmlTextReaderConstNamespaceUri(reader);
+    InferType *type = xmlHashLookup2(model->byName, local, ns);
+    InferFrame *frame;
+    int have_attr;
+
+    if (!type)
+    {
+        type = xmlMalloc(sizeof(InferType));
+        memset(type, 0, sizeof(InferType));
+        type->name = xmlStrdup(name);
+        type->ns = ns? xmlStrdup(ns) : NULL;
+        type->textTypes = INFER_ANY;
+        xmlHashAddEntry2(model->byName, local, ns, type);
+        if (model->ntypes == model->typesSize)
+        {
+            model->typesSize = model->typesSize? model->typesSize * 2 : 16;
+            model->types = xmlRealloc(model->types,
+                model->typesSize * sizeof(InferType*));
+        }
+        model->types[model->ntypes++] = type;
+    }
+    type->count++;
+
+    if (!model->haveRoot)
+    {
+        model->ns = ns? xmlStrdup(ns) : NULL;
+        model->haveRoot = 1;
+    }
+    if (depth > 0 && depth <= model->framesSize &&
+        model->frames[depth - 1].type)
+        inferChild(&model->frames[depth - 1], type);
+
+    for (have_attr = xmlTextReaderMoveToFirstAttribute(reader);
+         have_attr;
+         have_attr = xmlTextReaderMoveToNextAttribute(reader))
+    {
+        inferAttr(type, reader);
+    }
+    xmlTextReaderMoveToElement(reader);
+
+    if (depth >= model->framesSize)
+    {
+        int size = model->framesSize? model->framesSize * 2 : 32;
+        while (size <= depth) size *= 2;
+        model->frames = xmlRealloc(model->frames, size * sizeof(InferFrame));
+        memset(model->frames + model->framesSize, 0,
+            (size - model->framesSize) * sizeof(InferFrame));
+        model->framesSize = size;
+    }
+    frame = &model->frames[depth];
+    frame->type = type;
+    frame->hasText = 0;
+    frame->hasBlank = 0;
+    frame->textLen = 0;
+    frame->nruns = 0;
+
+    if (xmlTextReaderIsEmptyElement(reader)) inferEndElement(model, depth);
+}
+
+/**
+ *  feed text at @depth to the element holding it
+ */
+void
+inferText(InferModel *model, const xmlChar *text, int depth)
+{
+    InferFrame *frame;
+    const xmlChar *p;
+    int len;
+
+    if (depth < 1 || depth > model->framesSize || !text) return;
+    frame = &model->frames[depth - 1];
+    if (!frame->type) return;
+
+    for (p = text; *p && IS_BLANK_CH(*p); p++)
+        ;
+    if (*p) frame->hasText = 1;
+    else if (p != text) frame->hasBlank = 1;
+
+    len = xmlStrlen(text);
+    if (frame->textLen < 0 || frame->textLen + len > INFER_VALUE_MAX)
+        frame->textLen = -1;
+    else
+    {
+        memcpy(frame->text + frame->textLen, text, len);
+        frame->textLen += len;
+    }
+}
+
+/**
+ *  close the element open at @depth
+ */
+void
+inferEndElement(InferModel *model, int depth)
+{
+    InferFrame *frame;
+    InferType *type;
+    int i, j;
+
+    if (depth < 0 || depth >= model->framesSize) return;
+    frame = &model->frames[depth];
+    type = frame->type;
+    if (!type) return;
+    frame->type = NULL;
+    type->ended++;
+
+    if (frame->nruns)
+    {
+        type->withChildren++;
+        if (frame->hasText) type->mixed = 1;
+        for (i = 0; i < frame->nruns; i++)
+        {
+            InferChild *child = &type->children[frame->runs[i].child];
+            unsigned long count = frame->runs[i].count;
+
+            if (!child->instances || count < child->min) child->min = count;
+            if (count > child->max) child->max = count;
+            child->instances++;
+            for (j = i + 1; j < frame->nruns; j++)
+                type->before[frame->runs[i].child * type->childrenSize +
+                    frame->runs[j].child] = 1;
+        }
+    }
+    else if (frame->hasText || frame->hasBlank)
+    {
+        /* blank text, just as much as other text, isn't EMPTY */
+        type->withText++;
+        type->textTypes &= frame->textLen < 0? 0 :
+            inferValueTypes(frame->text, frame->textLen);
+    }
+}
+
+/**
+ *  return the children of @type in an order every instance agreed with,
+ *  or NULL if there is none
+ */
+static int *
+inferChildOrder(InferType *type)
+{
+    int n = type->nchildren, k, i, j;
+    int *order, *placed;
+
+    if (type->unordered) return NULL;
+    order = xmlMalloc(n * sizeof(int));
+    placed = xmlMalloc(n * sizeof(int));
+    memset(placed, 0, n * sizeof(int));
+
+    for (k = 0; k < n; k++)
+    {
+        /* the first child nothing left must come before */
+        for (i = 0; i < n; i++)
+        {
+            if (placed[i]) continue;
+            for (j = 0; j < n; j++)
+                if (!placed[j] && j != i &&
+                    type->before[j * type->childrenSize + i])
+                    break;
+            if (j == n) break;
+        }
+        if (i == n)
+        {
+            xmlFree(order);
+            order = NULL;
+            break;
+        }
+        order[k] = i;
+        placed[i] = 1;
+    }
+    xmlFree(placed);
+    return order;
+}
+
+static const xmlChar *
+inferLocalName(const xmlChar *name)
+{
+    const xmlChar *colon = xmlStrchr(name, ':');
+    return colon? colon + 1 : name;
+}
+
+static void
+inferWriteAttrValue(FILE *out, const xmlChar *value)
+{
+    for (; *value; value++)
+    {
+        if (*value == '&') fputs("&amp;", out);
+        else if (*value == '<') fputs("&lt;", out);
+        else if (*value == '"') fputs("&quot;", out);
+        else putc(*value, out);
+    }
+}
+
+static void
+inferWriteXsdAttrs(InferType *type, FILE *out, const char *indent)
+{
+    int i, foreign = 0;
+
+    for (i = 0; i < type->nattrs; i++)
+    {
+        InferAttr *attr = &type->attrs[i];
+
+        if (attr->nsDecl) continue;
+        if (attr->qualified)
+        {
+            foreign = 1;
+            continue;
+        }
+        fprintf(out, "%s<xs:attribute name=\"%s\" type=\"%s\"%s/>\n", indent,
+            attr->name, inferXsdType(attr->types),
+            attr->count == type->count? " use=\"required\"" : "");
+    }
+    if (foreign)
+        fprintf(out, "%s<xs:anyAttribute namespace=\"##other\""
+            " processContents=\"lax\"/>\n", indent);
+}
+
+/* only elements of the target namespace can be declared in the schema */
+static int
+inferForeign(InferModel *model, InferType *type)
+{
+    return !xmlStrEqual(type->ns, model->ns);
+}
+
+static int
+inferHasAttrs(InferType *type)
+{
+    int i;
+    for (i = 0; i < type->nattrs; i++)
+        if (!type->attrs[i].nsDecl) return 1;
+    return 0;
+}
+
+void
+inferWriteXsd(InferModel *model, FILE *out)
+{
+    int t, i;
+
+    fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(out, "<xs:schema xmlns:xs=\"http://www.w3.org/2001/XMLSchema\""
+        " elementFormDefault=\"qualified\"");
+    if (model->ns)
+    {
+        fprintf(out, "\n           targetNamespace=\"");
+        inferWriteAttrValue(out, model->ns);
+        fprintf(out, "\" xmlns=\"");
+        inferWriteAttrValue(out, model->ns);
+        fprintf(out, "\"");
+    }
+    fprintf(out, ">\n");
+
+    for (t = 0; t < model->ntypes; t++)
+    {
+        InferType *type = model->types[t];
+        const xmlChar *name = inferLocalName(type->name);
+        const char *textType = inferXsdType(
+            type->ended > type->withText? 0 : type->textTypes);
+        int foreign = 0;
+
+        if (inferForeign(model, type)) continue;
+        for (i = 0; i < type->nchildren; i++)
+            foreign |= inferForeign(model, type->children[i].type);
+
+        if (!type->withChildren)
+        {
+            if (!inferHasAttrs(type))
+            {
+                if (type->withText)
+                    fprintf(out, "  <xs:element name=\"%s\" type=\"%s\"/>\n",
+                        name, textType);
+                else
+                    fprintf(out, "  <xs:element name=\"%s\">\n"
+                        "    <xs:complexType/>\n  </xs:element>\n", name);
+            }
+            else if (type->withText)
+            {
+                fprintf(out, "  <xs:element name=\"%s\">\n"
+                    "    <xs:complexType>\n      <xs:simpleContent>\n"
+                    "        <xs:extension base=\"%s\">\n", name, textType);
+                inferWriteXsdAttrs(type, out, "          ");
+                fprintf(out, "        </xs:extension>\n"
+                    "      </xs:simpleContent>\n    </xs:complexType>\n"
+                    "  </xs:element>\n");
+            }
+            else
+            {
+                fprintf(out, "  <xs:element name=\"%s\">\n"
+                    "    <xs:complexType>\n", name);
+                inferWriteXsdAttrs(type, out, "      ");
+                fprintf(out, "    </xs:complexType>\n  </xs:element>\n");
+            }
+        }
+        else
+        {
+            int mixed = type->mixed || type->withText;
+            int *order = mixed || foreign? NULL : inferChildOrder(type);
+
+            fprintf(out, "  <xs:element name=\"%s\">\n"
+                "    <xs:complexType%s>\n", name,
+                mixed? " mixed=\"true\"" : "");
+            if (order)
+            {
+                fprintf(out, "      <xs:sequence>\n");
+                for (i = 0; i < type->nchildren; i++)
+                {
+                    InferChild *child = &type->children[order[i]];
+
+                    fprintf(out, "        <xs:element ref=\"%s\"",
+                        inferLocalName(child->type->name));
+                    if (child->instances < type->ended)
+                        fprintf(out, " minOccurs=\"0\"");
+                    if (child->max > 1)
+                        fprintf(out, " maxOccurs=\"unbounded\"");
+                    fprintf(out, "/>\n");
+                }
+                fprintf(out, "      </xs:sequence>\n");
+                xmlFree(order);
+            }
+            else
+            {
+                fprintf(out, "      <xs:choice minOccurs=\"0\""
+                    " maxOccurs=\"unbounded\">\n");
+                for (i = 0; i < type->nchildren; i++)
+                    if (!inferForeign(model, type->children[i].type))
+                        fprintf(out, "        <xs:element ref=\"%s\"/>\n",
+                            inferLocalName(type->children[i].type->name));
+                if (foreign)
+                    fprintf(out, "        <xs:any namespace=\"##other\""
+                        " processContents=\"lax\"/>\n");
+                fprintf(out, "      </xs:choice>\n");
+            }
+            inferWriteXsdAttrs(type, out, "      ");
+            fprintf(out, "    </xs:complexType>\n  </xs:element>\n");
+        }
+    }
+    fprintf(out, "</xs:schema>\n");
+}
+
+void
+inferWriteDtd(InferModel *model, FILE *out)
+{
+    int t, i;
+
+    for (t = 0; t < model->ntypes; t++)
+    {
+        InferType *type = model->types[t];
+
+        fprintf(out, "<!ELEMENT %s ", type->name);
+        if (!type->withChildren)
+            fprintf(out, type->withText? "(#PCDATA)" : "EMPTY");
+        else if (type->mixed || type->withText)
+        {
+            fprintf(out, "(#PCDATA");
+            for (i = 0; i < type->nchildren; i++)
+                fprintf(out, "|%s", type->children[i].type->name);
+            fprintf(out, ")*");
+        }
+        else
+        {
+            int *order = inferChildOrder(type);
+
+            for (i = 0; i < type->nchildren; i++)
+            {
+                InferChild *child = &type->children[order? order[i] : i];
+                int optional = child->instances < type->ended;
+
+                fprintf(out, "%s%s", i? (order? "," : "|") : "(",
+                    child->type->name);
+                if (order && child->max > 1)
+                    putc(optional? '*' : '+', out);
+                else if (order && optional)
+                    putc('?', out);
+            }
+            putc(')', out);
+            if (!order)
+                putc(type->ended > type->withChildren? '*' : '+', out);
+            xmlFree(order);
+        }
+        fprintf(out, ">\n");
+
+        for (i = 0; i < type->nattrs; i++)
+        {
+            InferAttr *attr = &type->attrs[i];
+            fprintf(out, "<!ATTLIST %s %s CDATA %s>\n", type->name,
+                attr->name,
+                attr->count == type->count? "#REQUIRED" : "#IMPLIED");
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef INFER_H
+#define INFER_H
+
+#include <stdio.h>
+#include <libxml/xmlreader.h>
+
+/*
+ *  best guess of a schema for the documents fed through a reader: one
+ *  record per element name, so memory follows the vocabulary, not the
+ *  amount of data
+ */
+
+typedef struct _InferModel InferModel;
+
+InferModel *inferNew(void);
+void inferElement(InferModel *model, xmlTextReaderPtr reader, int depth);
+void inferEndElement(InferModel *model, int depth);
+void inferText(InferModel *model, const xmlChar *text, int depth);
+void inferWriteXsd(InferModel *model, FILE *out);
+void inferWriteDtd(InferModel *model, FILE *out);
+void inferFree(InferModel *model);
+
+#endif  /* INFER_H */
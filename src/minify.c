@@ -0,0 +1,455 @@
+/*
+
+XMLStarlet: Command Line Toolkit to query/edit/check/transform XML documents
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <config.h>
+
+#include <string.h>
+
+#include <libxml/xmlmemory.h>
+#include <libxml/xmlstring.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define MINIFY_SSE2 1
+#endif
+
+#include "minify.h"
+
+#define BOM "\xEF\xBB\xBF"    /* UTF-8 byte order mark */
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+#define MINIFY_BUFSIZE (64 * 1024)
+
+typedef struct _Minifier {
+    const char *copied;         /* input up to here is written or dropped */
+    xmlOutputWriteCallback write;
+    void *context;
+    char buf[MINIFY_BUFSIZE];   /* spans between dropped text, gathered */
+    size_t len;
+    int spaces;                 /* the input has xml:space attributes */
+    unsigned char *preserve;    /* xml:space="preserve" by depth */
+    int depth, preserveSize;
+    int cdataText;              /* the last markup was a CDATA section now
+                                   text: the whitespace after it is kept */
+} Minifier;
+
+/**
+ *  first @a, @b or @c in [@p, @end), or @end
+ */
+static const char *
+minFind3(const char *p, const char *end, char a, char b, char c)
+{
+#ifdef MINIFY_SSE2
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b),
+        vc = _mm_set1_epi8(c);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+            _mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+            _mm_cmpeq_epi8(v, vc)));
+        if (m) return p + __builtin_ctz(m);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != a && *p != b && *p != c) p++;
+    return p;
+}
+
+/**
+ *  end of the first @close (ending with '>') in [@p, @end), or NULL
+ */
+static const char *
+minFindClose(const char *p, const char *end, const char *close)
+{
+    size_t len = strlen(close);
+
+    p += len - 1;
+    while (p < end && (p = memchr(p, '>', end - p)) != NULL) {
+        if (!memcmp(p + 1 - len, close, len)) return p + 1;
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ *  end of the tag starting at @p, skipping quoted attribute values
+ */
+static const char *
+minTagEnd(const char *p, const char *end)
+{
+    for (;;) {
+        p = minFind3(p, end, '>', '"', '\'');
+        if (p == end) return NULL;
+        if (*p == '>') return p + 1;
+        p = memchr(p + 1, *p, end - p - 1);
+        if (p == NULL) return NULL;
+        p++;
+    }
+}
+
+/**
+ *  end of the DOCTYPE at @p: '>' outside quotes, comments and the
+ *  internal subset
+ */
+static const char *
+minDoctypeEnd(const char *p, const char *end)
+{
+    int subset = 0;
+
+    for (p += 2; p < end; p++) {
+        if (*p == '"' || *p == '\'') {
+            p = memchr(p + 1, *p, end - p - 1);
+            if (p == NULL) return NULL;
+        } else if (*p == '<' && end - p >= 4 && !memcmp(p, "<!--", 4)) {
+            p = minFindClose(p + 4, end, "-->");
+            if (p == NULL) return NULL;
+            p--;
+        } else if (*p == '<' && end - p >= 2 && p[1] == '?') {
+            p = minFindClose(p + 2, end, "?>");
+            if (p == NULL) return NULL;
+            p--;
+        } else if (*p == '[') {
+            subset = 1;
+        } else if (*p == ']') {
+            subset = 0;
+        } else if (*p == '>' && !subset) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  the xml:space value given in the start tag [@p, @end): 1 for preserve,
+ *  0 for default, -1 if there is none
+ */
+static int
+minXmlSpace(const char *p, const char *end)
+{
+    const char *s;
+
+    for (s = p; (s = memchr(s, 'x', end - s)) != NULL; s++) {
+        if (end - s < 9 || memcmp(s, "xml:space", 9) || !IS_SPACE(s[-1]))
+            continue;
+        for (s += 9; s < end && IS_SPACE(*s); s++)
+            ;
+        if (s == end || *s++ != '=') continue;
+        while (s < end && IS_SPACE(*s)) s++;
+        if (s == end || (*s != '"' && *s != '\'')) continue;
+        return end - s > 9 && !memcmp(s + 1, "preserve", 8) && s[9] == *s;
+    }
+    return -1;
+}
+
+/**
+ *  whether the XML declaration [@p, @end) names an encoding other than
+ *  UTF-8 or ASCII, which the bytes copied after it would need
+ */
+static int
+minOtherEncoding(const char *p, const char *end)
+{
+    const char *s, *q;
+    size_t len;
+
+    for (s = p; (s = memchr(s, 'e', end - s)) != NULL; s++) {
+        if (end - s < 8 || memcmp(s, "encoding", 8) || !IS_SPACE(s[-1]))
+            continue;
+        for (s += 8; s < end && IS_SPACE(*s); s++)
+            ;
+        if (s == end || *s++ != '=') continue;
+        while (s < end && IS_SPACE(*s)) s++;
+        if (s == end || (*s != '"' && *s != '\'')) continue;
+        q = memchr(s + 1, *s, end - s - 1);
+        if (q == NULL) return 1;
+        len = q - s - 1;
+        return !((len == 5 && !xmlStrncasecmp(BAD_CAST s + 1,
+                    BAD_CAST "UTF-8", 5)) ||
+                 (len == 8 && !xmlStrncasecmp(BAD_CAST s + 1,
+                    BAD_CAST "US-ASCII", 8)) ||
+                 (len == 5 && !xmlStrncasecmp(BAD_CAST s + 1,
+                    BAD_CAST "ASCII", 5)));
+    }
+    return 0;
+}
+
+static void
+minWrite(Minifier *m, const char *p, size_t len)
+{
+    if (m->len + len > MINIFY_BUFSIZE) {
+        m->write(m->context, m->buf, m->len);
+        m->len = 0;
+    }
+    if (len >= MINIFY_BUFSIZE) {
+        m->write(m->context, p, len);
+    } else {
+        memcpy(m->buf + m->len, p, len);
+        m->len += len;
+    }
+}
+
+/**
+ *  write what is pending and skip [@p, @end)
+ */
+static void
+minDrop(Minifier *m, const char *p, const char *end)
+{
+    if (p > m->copied) minWrite(m, m->copied, p - m->copied);
+    m->copied = end;
+}
+
+/**
+ *  write a CDATA section's content [@p, @end) as text
+ */
+static void
+minCdataText(Minifier *m, const char *p, const char *end)
+{
+    const char *s;
+
+    while ((s = minFind3(p, end, '<', '>', '&')) < end) {
+        minWrite(m, p, s - p);
+        if (*s == '<') minWrite(m, "&lt;", 4);
+        else if (*s == '>') minWrite(m, "&gt;", 4);
+        else minWrite(m, "&amp;", 5);
+        p = s + 1;
+    }
+    minWrite(m, p, end - p);
+}
+
+/**
+ *  enter an element; @space is what minXmlSpace() found in its start tag
+ */
+static void
+minPush(Minifier *m, int space)
+{
+    if (m->depth + 1 >= m->preserveSize) {
+        m->preserveSize = m->preserveSize? 2 * m->preserveSize : 64;
+        m->preserve = xmlRealloc(m->preserve, m->preserveSize);
+    }
+    m->depth++;
+    m->preserve[m->depth] = (space < 0)? m->preserve[m->depth - 1] : space;
+}
+
+/**
+ *  end of the comment, CDATA section, PI or DOCTYPE at @p, which is
+ *  dropped or converted as @flags say; NULL with @error set if it isn't
+ *  closed
+ */
+static const char *
+minMarkup(Minifier *m, const char *data, const char *p, const char *end,
+    int flags, const char **error)
+{
+    const char *q;
+
+    if (end - p >= 4 && !memcmp(p, "<!--", 4)) {
+        q = minFindClose(p + 4, end, "-->");
+        if (q == NULL) *error = "comment not terminated";
+    } else if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9)) {
+        q = minFindClose(p + 9, end, "]]>");
+        if (q == NULL) {
+            *error = "CDATA section not terminated";
+        } else if (flags & MINIFY_NOCDATA) {
+            minDrop(m, p, q);
+            minCdataText(m, p + 9, q - 3);
+            m->cdataText = 1;
+        }
+    } else if (p[1] == '?') {
+        q = minFindClose(p + 2, end, "?>");
+        if (q == NULL)
+            *error = "processing instruction not terminated";
+        else if ((flags & MINIFY_OMIT_DECL) &&
+            (p == data || (p == data + 3 && !memcmp(data, BOM, 3))) &&
+            end - p > 6 && !memcmp(p, "<?xml", 5) && IS_SPACE(p[5]) &&
+            !minOtherEncoding(p, q))
+            minDrop(m, p, q);
+    } else if (end - p >= 9 && !memcmp(p, "<!DOCTYPE", 9)) {
+        q = minDoctypeEnd(p, end);
+        if (q == NULL) *error = "DOCTYPE not terminated";
+        else if (flags & MINIFY_DROP_DTD) minDrop(m, p, q);
+    } else {
+        q = minTagEnd(p + 1, end);
+        if (q == NULL) *error = "markup not terminated";
+    }
+    return q;
+}
+
+#ifdef MINIFY_SSE2
+/**
+ *  the loop for input without xml:space, sixteen bytes at a time.  Only
+ *  '<' in text and '>' in tags matter: a '>' in an attribute value ends
+ *  the tag early, but the "text" after it holds the closing quote, so it
+ *  is never dropped.  Returns where an unclosed construct starts, or @end.
+ */
+static const char *
+minScan(Minifier *m, const char *data, const char *p, const char *end,
+    int flags, const char **error)
+{
+    const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'),
+        sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'),
+        nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const char *text = p;       /* start of the current text */
+    const char *tag = NULL;     /* start of the current tag */
+    int blank = 1;              /* no text character since @text */
+    char pad[16];
+
+    while (p < end) {
+        __m128i v;
+        unsigned int mlt, mgt, mtext;
+        int i = 0, k;
+
+        if (end - p >= 16) {
+            v = _mm_loadu_si128((const __m128i *) p);
+        } else {
+            memset(pad, ' ', sizeof(pad));
+            memcpy(pad, p, end - p);
+            v = _mm_loadu_si128((const __m128i *) pad);
+        }
+        mlt = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lt));
+        mgt = _mm_movemask_epi8(_mm_cmpeq_epi8(v, gt));
+        mtext = ~_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr))));
+
+        while (i < 16) {
+            unsigned int next = (tag? mgt : mlt) & (0xFFFFu << i);
+
+            k = next? __builtin_ctz(next) : 16;
+            if (tag) {
+                if (k == 16) break;
+                tag = NULL;
+                text = p + k + 1;
+                blank = 1;
+            } else {
+                if (mtext & ((1u << k) - 1) & (0xFFFFu << i)) blank = 0;
+                if (k == 16) break;
+                if (blank && text < p + k) minDrop(m, text, p + k);
+                if (p + k + 1 < end && (p[k + 1] == '!' || p[k + 1] == '?'))
+                    break;
+                tag = p + k;
+            }
+            i = k + 1;
+        }
+
+        if (i < 16 && k < 16) {
+            /* comment, CDATA, PI or DOCTYPE: skip it whole */
+            const char *q;
+
+            m->cdataText = 0;
+            q = minMarkup(m, data, p + k, end, flags, error);
+            if (q == NULL) return p + k;
+            p = text = q;
+            blank = !m->cdataText;
+        } else {
+            p += 16;
+        }
+    }
+
+    if (tag != NULL) {
+        *error = (tag[1] == '/')? "end tag not terminated" :
+            "start tag not terminated";
+        return tag;
+    }
+    if (blank && text < end) minDrop(m, text, end);
+    return end;
+}
+#endif
+
+/**
+ *  Copy the document [@data, @data + @size) to @write without whitespace
+ *  only text outside xml:space="preserve".  Everything else is copied
+ *  as it is, in as few writes as possible.  The input is not checked
+ *  for well-formedness; returns 0, or -1 with @error and @offset set
+ *  when a construct is not closed.
+ */
+int
+minify(const char *data, size_t size, xmlOutputWriteCallback write,
+    void *context, int flags, const char **error, size_t *offset)
+{
+    const char *p = data, *end = data + size, *q;
+    Minifier *m;
+
+    *error = NULL;
+    if (size >= 2 && ((p[0] == '\xFE' && p[1] == '\xFF') ||
+        (p[0] == '\xFF' && p[1] == '\xFE'))) {
+        *error = "UTF-16 input is not supported";
+        *offset = 0;
+        return -1;
+    }
+
+    m = xmlMalloc(sizeof(Minifier));
+    memset(m, 0, sizeof(Minifier));
+    m->copied = data;
+    m->write = write;
+    m->context = context;
+    m->preserveSize = 64;
+    m->preserve = xmlMalloc(m->preserveSize);
+    m->preserve[0] = 0;
+    /* without xml:space there is no need to follow the nesting */
+    for (q = data; (q = memchr(q, ':', end - q)) != NULL; q++) {
+        if (q - data >= 3 && end - q >= 6 && !memcmp(q - 3, "xml:space", 9)) {
+            m->spaces = 1;
+            break;
+        }
+    }
+
+#ifdef MINIFY_SSE2
+    if (!m->spaces) p = minScan(m, data, p, end, flags, error);
+#endif
+    while (p < end && *error == NULL) {
+        if (*p != '<') {
+            q = memchr(p, '<', end - p);
+            if (q == NULL) q = end;
+            if (!m->preserve[m->depth] && !m->cdataText) {
+                const char *s = p;
+                while (s < q && IS_SPACE(*s)) s++;
+                if (s == q) minDrop(m, p, q);
+            }
+            p = q;
+            continue;
+        }
+
+        m->cdataText = 0;
+        if (end - p >= 2 && (p[1] == '!' || p[1] == '?')) {
+            q = minMarkup(m, data, p, end, flags, error);
+        } else if (end - p >= 2 && p[1] == '/') {
+            q = memchr(p, '>', end - p);
+            if (q == NULL) *error = "end tag not terminated";
+            else q++;
+            if (m->depth > 0) m->depth--;
+        } else {
+            q = minTagEnd(p + 1, end);
+            if (q == NULL) *error = "start tag not terminated";
+            else if (q[-2] != '/') minPush(m, minXmlSpace(p, q));
+        }
+        if (*error == NULL) p = q;
+    }
+
+    minDrop(m, p, p);
+    if (m->len > 0) write(context, m->buf, m->len);
+    xmlFree(m->preserve);
+    xmlFree(m);
+    if (*error == NULL) return 0;
+    *offset = p - data;
+    return -1;
+}
@@ -0,0 +1,18 @@
+#ifndef MINIFY_H
+#define MINIFY_H
+
+#include <stddef.h>
+#include <libxml/xmlIO.h>
+
+/*
+ *  whitespace stripping over the raw bytes of a document, without a parser
+ */
+
+#define MINIFY_OMIT_DECL  1     /* drop the XML declaration */
+#define MINIFY_DROP_DTD   2     /* drop the DOCTYPE */
+#define MINIFY_NOCDATA    4     /* CDATA sections become escaped text */
+
+int minify(const char *data, size_t size, xmlOutputWriteCallback write,
+    void *context, int flags, const char **error, size_t *offset);
+
+#endif  /* MINIFY_H */
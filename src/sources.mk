@@ -29,7 +29,17 @@ src/unescape-usage.c\
 src/validate-usage.c
 
 xml_SOURCES =\
+src/c14nstream.c\
+src/c14nstream.h\
+src/digest.c\
+src/digest.h\
 src/escape.h\
+src/filemap.c\
+src/filemap.h\
+src/infer.c\
+src/infer.h\
+src/minify.c\
+src/minify.h\
 src/trans.c\
 src/trans.h\
 src/xml.c\
@@ -406,7 +406,6 @@ static void bad_ns_opt(const char *msg)
 
 const xmlChar *default_ns = NULL;
 
-#define MAX_NS_ARGS    256
 xmlChar *ns_arr[2 * MAX_NS_ARGS + 1];
 
 /**
@@ -28,6 +28,8 @@
 #include <libxml/c14n.h>
 
 #include "xmlstar.h"
+#include "c14nstream.h"
+#include "digest.h"
 
 static void c14nUsage(const char *name, exit_status status)
 {
@@ -48,22 +50,317 @@ static xmlChar **parse_list(xmlChar *str);
 static void print_xpath_nodes(xmlNodeSetPtr nodes);
 #endif
 
+/*
+ * The nodes of an XPath selection, hashed: libxml2's own visibility check
+ * searches the node set linearly for every node it renders.  Namespace
+ * nodes in the set are copies, told apart by their element and prefix,
+ * so that is their key.
+ */
+typedef struct _c14nSetEntry {
+    const void *node;           /* node, or the element of a namespace */
+    const xmlChar *prefix;      /* of a namespace */
+    int ns;                     /* this is a namespace */
+} c14nSetEntry;
+
+typedef struct _c14nSet {
+    c14nSetEntry *table;
+    unsigned long mask;
+} c14nSet;
+
+static unsigned long
+c14nSetHash(const void *node, const xmlChar *prefix, int ns)
+{
+    unsigned long h = (unsigned long) node;
+
+    h = (h >> 4) * 2654435761UL;
+    if (ns) {
+        h ^= 0x9e3779b9UL;
+        if (prefix != NULL)
+            while (*prefix) h = h * 31 + *prefix++;
+    }
+    return h ^ (h >> 16);
+}
+
+static c14nSetEntry *
+c14nSetFind(const c14nSet *set, const void *node, const xmlChar *prefix,
+            int ns) {
+    unsigned long i = c14nSetHash(node, prefix, ns) & set->mask;
+
+    for (;;) {
+        c14nSetEntry *e = &set->table[i];
+        if (e->node == NULL ||
+            (e->node == node && e->ns == ns &&
+             (!ns || xmlStrEqual(e->prefix, prefix))))
+            return e;
+        i = (i + 1) & set->mask;
+    }
+}
+
+static void
+c14nSetInit(c14nSet *set, xmlNodeSetPtr nodes) {
+    unsigned long size = 16;
+    int i;
+
+    while (size < 2UL * nodes->nodeNr) size *= 2;
+    set->table = xmlMalloc(size * sizeof(c14nSetEntry));
+    memset(set->table, 0, size * sizeof(c14nSetEntry));
+    set->mask = size - 1;
+    for (i = 0; i < nodes->nodeNr; i++) {
+        xmlNodePtr cur = nodes->nodeTab[i];
+        c14nSetEntry *e;
+
+        if (cur->type == XML_NAMESPACE_DECL) {
+            xmlNsPtr ns = (xmlNsPtr) cur;
+            e = c14nSetFind(set, ns->next, ns->prefix, 1);
+            e->node = ns->next;
+            e->prefix = ns->prefix;
+            e->ns = 1;
+        } else {
+            e = c14nSetFind(set, cur, NULL, 0);
+            e->node = cur;
+        }
+    }
+}
+
+/*
+ * xmlC14NIsVisibleCallback: what xmlC14NIsNodeInNodeset() answers, in
+ * constant time
+ */
+static int
+c14nIsVisible(void *user_data, xmlNodePtr node, xmlNodePtr parent) {
+    c14nSet *set = user_data;
+
+    if (node == NULL) return(1);
+    if (node->type != XML_NAMESPACE_DECL)
+        return(c14nSetFind(set, node, NULL, 0)->node != NULL);
+    if ((parent != NULL) && (parent->type == XML_ATTRIBUTE_NODE))
+        parent = parent->parent;
+    if (parent == NULL) return(0);
+    return(c14nSetFind(set, parent, ((xmlNsPtr) node)->prefix, 1)->node
+           != NULL);
+}
+
+/*
+ * Canonical output of a whole document is written as it is parsed; the
+ * first C14N_HOLD bytes are held back, so that a document found not to be
+ * well-formed by then writes nothing, as it does when it is loaded first.
+ */
+#define C14N_HOLD (1024 * 1024)
+
+typedef struct _c14nHold {
+    char *data;
+    int len;
+    int passed;                 /* held data is out, the rest goes through */
+} c14nHold;
+
+static int
+c14nHoldRelease(c14nHold *hold)
+{
+    int ok = 1;
+
+    if (hold->len > 0)
+        ok = (fwrite(hold->data, 1, hold->len, stdout) == (size_t) hold->len);
+    xmlFree(hold->data);
+    hold->data = NULL;
+    hold->len = 0;
+    hold->passed = 1;
+    return ok;
+}
+
+static int
+c14nHoldWrite(void *context, const char *buffer, int len)
+{
+    c14nHold *hold = context;
+
+    if (!hold->passed) {
+        if (hold->data == NULL)
+            hold->data = xmlMalloc(C14N_HOLD);
+        if (hold->data == NULL) return -1;
+        if (hold->len + len <= C14N_HOLD) {
+            memcpy(hold->data + hold->len, buffer, len);
+            hold->len += len;
+            return len;
+        }
+        if (!c14nHoldRelease(hold)) return -1;
+    }
+    return (fwrite(buffer, 1, len, stdout) == (size_t) len) ? len : -1;
+}
+
+static int
+c14nHoldClose(void *context)
+{
+    return (fflush(stdout) == 0) ? 0 : -1;
+}
+
+/*
+ * Exit status for what c14nStream() returned
+ */
+static int
+stream_status(const char* xml_filename, int ret) {
+    if (ret == C14N_STREAM_BAD_FILE) {
+        fprintf(stderr, "Error: unable to parse file \"%s\"\n", xml_filename);
+        return(EXIT_BAD_FILE);
+    }
+    if (ret < 0) {
+        fprintf(stderr,"Error: failed to canonicalize XML file \"%s\" (ret=%d)\n",
+            xml_filename, ret);
+        return(EXIT_FAILURE);
+    }
+    return(EXIT_SUCCESS);
+}
+
+/*
+ * The whole document: nothing needs the tree, so none is built
+ */
+static int
+stream_c14n(const char* xml_filename, int with_comments, int exclusive,
+            int options) {
+    xmlOutputBufferPtr buf;
+    c14nHold hold;
+    int ret;
+
+    set_stdout_binary();       /* avoid line ending conversion */
+    memset(&hold, 0, sizeof(hold));
+    buf = xmlOutputBufferCreateIO(c14nHoldWrite, c14nHoldClose, &hold, NULL);
+    ret = c14nStream(xml_filename, options, exclusive, with_comments, buf);
+    if (xmlOutputBufferClose(buf) < 0 && ret == 0) ret = -1;
+    if (ret == C14N_STREAM_BAD_FILE)
+        hold.len = 0;           /* drop what is held */
+    if (!c14nHoldRelease(&hold) && ret == 0) ret = -1;
+    return stream_status(xml_filename, ret);
+}
+
+/*
+ * --digest: the canonical form goes into a hash instead of to stdout
+ */
+typedef enum {
+    C14N_SHA256,
+    C14N_SHA1,
+    C14N_XXH64
+} c14nDigestAlg;
+
+typedef struct _c14nDigest {
+    c14nDigestAlg alg;
+    shaState sha;
+    xxh64State xxh;
+} c14nDigest;
+
+static int
+c14nDigestWrite(void *context, const char *buffer, int len)
+{
+    c14nDigest *digest = context;
+
+    if (digest->alg == C14N_XXH64)
+        xxh64Update(&digest->xxh, buffer, len);
+    else
+        shaUpdate(&digest->sha, buffer, len);
+    return len;
+}
+
+/*
+ * print the digest of the canonical form of a whole document, as
+ * sha256sum does
+ */
+static int
+digest_c14n(const char* xml_filename, int with_comments, int exclusive,
+            int options, c14nDigestAlg alg) {
+    xmlOutputBufferPtr buf;
+    c14nDigest digest;
+    unsigned char sum[SHA256_SIZE];
+    int ret, i, size = 0;
+
+    digest.alg = alg;
+    if (alg == C14N_XXH64)
+        xxh64Init(&digest.xxh, 0);
+    else if (alg == C14N_SHA1)
+        sha1Init(&digest.sha);
+    else
+        sha256Init(&digest.sha);
+    buf = xmlOutputBufferCreateIO(c14nDigestWrite, NULL, &digest, NULL);
+    ret = c14nStream(xml_filename, options, exclusive, with_comments, buf);
+    if (xmlOutputBufferClose(buf) < 0 && ret == 0) ret = -1;
+    if (ret != 0)
+        return stream_status(xml_filename, ret);
+
+    if (alg == C14N_XXH64) {
+        uint64_t h = xxh64Final(&digest.xxh);
+
+        printf("%08lx%08lx", (unsigned long) (h >> 16 >> 16),
+            (unsigned long) (h & 0xffffffffUL));
+    } else {
+        size = (alg == C14N_SHA1) ? SHA1_SIZE : SHA256_SIZE;
+        shaFinal(&digest.sha, sum);
+    }
+    for (i = 0; i < size; i++)
+        printf("%02x", sum[i]);
+    printf("  %s\n", xml_filename);
+    return(EXIT_SUCCESS);
+}
+
+static int
+digest_main(int argc, char **argv, int nonet) {
+    const char *name = (argc > 3) ? argv[3] : "";
+    c14nDigestAlg alg;
+    int with_comments = 1, exclusive = 0, i = 4, ret = EXIT_SUCCESS;
+    int options = XML_PARSE_NOENT | XML_PARSE_DTDLOAD |
+        XML_PARSE_DTDATTR | (nonet? XML_PARSE_NONET:0);
+
+    if (strcmp(name, "sha256") == 0) {
+        alg = C14N_SHA256;
+    } else if (strcmp(name, "sha1") == 0) {
+        alg = C14N_SHA1;
+    } else if (strcmp(name, "xxh64") == 0) {
+        alg = C14N_XXH64;
+    } else {
+        fprintf(stderr, "error: unknown digest '%s'.\n", name);
+        c14nUsage(argv[0], EXIT_BAD_ARGS);
+    }
+
+    if (i < argc && strcmp(argv[i], "--with-comments") == 0) {
+        i++;
+    } else if (i < argc && strcmp(argv[i], "--without-comments") == 0) {
+        with_comments = 0;
+        i++;
+    } else if (i < argc && strcmp(argv[i], "--exc-with-comments") == 0) {
+        exclusive = 1;
+        i++;
+    } else if (i < argc && strcmp(argv[i], "--exc-without-comments") == 0) {
+        with_comments = 0;
+        exclusive = 1;
+        i++;
+    }
+    if (i == argc)
+        return digest_c14n("-", with_comments, exclusive, options, alg);
+
+    /* go on after a bad file; report the first failure */
+    for (; i < argc; i++) {
+        int r = digest_c14n(argv[i], with_comments, exclusive, options, alg);
+        if (ret == EXIT_SUCCESS) ret = r;
+    }
+    return ret;
+}
+
 static int 
 run_c14n(const char* xml_filename, int with_comments, int exclusive,
          const char* xpath_filename, xmlChar **inclusive_namespaces,
          int nonet) {
     xmlDocPtr doc;
     xmlXPathObjectPtr xpath = NULL; 
+    xmlOutputBufferPtr buf;
+    c14nSet set;
     int ret;
+    int options = XML_PARSE_NOENT | XML_PARSE_DTDLOAD |
+        XML_PARSE_DTDATTR | (nonet? XML_PARSE_NONET:0);
+
+    if (xpath_filename == NULL)
+        return stream_c14n(xml_filename, with_comments, exclusive, options);
 
     /*
      * build an XML tree from a the file; we need to add default
      * attributes and resolve all character and entities references
      */
 
-    doc = xmlReadFile(xml_filename, NULL,
-        XML_PARSE_NOENT | XML_PARSE_DTDLOAD |
-        XML_PARSE_DTDATTR | (nonet? XML_PARSE_NONET:0));
+    doc = xmlReadFile(xml_filename, NULL, options);
     if (doc == NULL) {
         fprintf(stderr, "Error: unable to parse file \"%s\"\n", xml_filename);
         return(EXIT_BAD_FILE);
@@ -82,6 +379,8 @@ run_c14n(const char* xml_filename, int with_comments, int exclusive,
      * load xpath file if specified 
      */
     if(xpath_filename) {
+        /* number the elements, or sorting the result is quadratic */
+        xmlXPathOrderDocElems(doc);
         xpath = load_xpath_expr(doc, xpath_filename);
         if(xpath == NULL) {
             fprintf(stderr,"Error: unable to evaluate xpath expression\n");
@@ -94,10 +393,19 @@ run_c14n(const char* xml_filename, int with_comments, int exclusive,
      * Canonical form
      */
     set_stdout_binary();       /* avoid line ending conversion */
-    ret = xmlC14NDocSave(doc,
-        (xpath) ? xpath->nodesetval : NULL,
+    set.table = NULL;
+    if ((xpath != NULL) && (xpath->nodesetval != NULL))
+        c14nSetInit(&set, xpath->nodesetval);
+    buf = xmlOutputBufferCreateFilename("-", NULL, 0);
+    ret = xmlC14NExecute(doc,
+        (set.table) ? c14nIsVisible : NULL, &set,
         exclusive, inclusive_namespaces,
-        with_comments, "-", 0);
+        with_comments, buf);
+    xmlFree(set.table);
+    if (ret >= 0)
+        ret = xmlOutputBufferClose(buf);
+    else
+        xmlOutputBufferClose(buf);
     if(ret < 0) {
         fprintf(stderr,"Error: failed to canonicalize XML file \"%s\" (ret=%d)\n",
             xml_filename, ret);
@@ -134,7 +442,9 @@ int c14nMain(int argc, char **argv) {
         argv++;
     }
 
-    if (argc < 4) {
+    if (argc > 2 && strcmp(argv[2], "--digest") == 0) {
+        ret = digest_main(argc, argv, nonet);
+    } else if (argc < 4) {
         if (argc >= 3)
         {
             if (strcmp(argv[2], "--help") == 0 || strcmp(argv[2], "-h") == 0)
@@ -40,6 +40,7 @@ THE SOFTWARE.
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/xpointer.h>
+#include <libxml/pattern.h>
 #include <libxml/parserInternals.h>
 #include <libxml/uri.h>
 #include <libexslt/exslt.h>
@@ -58,6 +59,7 @@ typedef struct _edOptions {   /* Global 'edit' options */
     int omit_decl;            /* Omit XML declaration line <?xml version="1.0"?> */
     int inplace;              /* Edit file inplace (no output on stdout) */
     int nonet;                /* Disallow network access */
+    const char *patch_out;    /* Write XUpdate of the changes here instead */
 } edOptions;
 
 typedef edOptions *edOptionsPtr;
@@ -81,7 +83,8 @@ typedef enum _XmlNodeType {
    XML_TEXT,
    XML_COMT,
    XML_CDATA,
-   XML_EXPR
+   XML_EXPR,
+   XML_FRAG
 } XmlNodeType;
 
 typedef struct {
@@ -104,13 +107,16 @@ static const OptionSpec
     OPT_NODE_TYPE[] = {
         {0, "elem", XML_ELEM},
         {0, "attr", XML_ATTR},
-        {0, "text", XML_TEXT}
+        {0, "text", XML_TEXT},
+        {0, "xml", XML_FRAG}
     },
     OPT_JUST_NAME[] = {
         {'n', "--name"}
     };
 
 
+#define XUPDATE_NS "http://www.xmldb.org/xupdate"
+
 typedef const char* XmlEdArg;
 
 typedef struct _XmlEdAction {
@@ -119,8 +125,18 @@ typedef struct _XmlEdAction {
   XmlEdArg      arg2;
   XmlEdArg      arg3;
   XmlNodeType   type;
+  xmlChar      *buf;            /* storage owned by this action, if any */
+  xmlNodePtr    content;        /* nodes to insert, for --xupdate */
+  xmlXPathCompExprPtr xpath;    /* compiled arg1 (arg2 for --var) */
+  int           variant;        /* 0 for the document, else --variant no. */
 } XmlEdAction;
 
+typedef struct _XmlEdVariant {  /* --variant <output> ... -- */
+  const char   *output;
+  int           first;          /* its actions in the array of actions */
+  int           count;
+} XmlEdVariant;
+
 /**
  *  display short help message
  */
@@ -146,6 +162,7 @@ edInitOptions(edOptionsPtr ops)
     ops->preserveFormat = 0;
     ops->inplace = 0;
     ops->nonet = 1;
+    ops->patch_out = NULL;
 }
 
 /**
@@ -179,6 +196,11 @@ edParseOptions(edOptionsPtr ops, int argc, char **argv)
         {
             ops->nonet = 0;
         }
+        else if (!strcmp(argv[i], "--patch-out"))
+        {
+            if (++i >= argc) edUsage(argv[0], EXIT_BAD_ARGS);
+            ops->patch_out = argv[i];
+        }
         else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h") ||
                  !strcmp(argv[i], "-?") || !strcmp(argv[i], "-Z"))
         {
@@ -230,6 +252,295 @@ extract_ns_defs(xmlDocPtr doc, xmlXPathContextPtr ctxt)
     }
 }
 
+/* modifications recorded for --patch-out, as an XUpdate document */
+static xmlDocPtr patch = NULL;
+
+/**
+ *  prefix the patch's root declares for namespace @ns; one per namespace,
+ *  as the document may bind a prefix to other namespaces in other scopes
+ */
+static const xmlChar *
+patchPrefix(xmlNsPtr ns)
+{
+    xmlNodePtr root = xmlDocGetRootElement(patch);
+    const xmlChar *prefix = ns->prefix;
+    xmlChar name[32];
+    xmlNsPtr def;
+    int n = 0;
+
+    for (def = root->nsDef; def; def = def->next)
+        if (def->prefix && xmlStrEqual(def->href, ns->href))
+            return def->prefix;
+    while (!prefix || xmlSearchNs(patch, root, prefix))
+    {
+        sprintf((char *) name, "ns%d", ++n);
+        prefix = name;
+    }
+    return xmlNewNs(root, ns->href, prefix)->prefix;
+}
+
+/**
+ *  name of @node in a path step, NULL if it has none
+ */
+static const xmlChar *
+patchName(xmlNodePtr node)
+{
+    switch (node->type)
+    {
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_PI_NODE:
+            return node->name;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ *  @a and @b would be selected by the same path step
+ */
+static int
+patchSameStep(xmlNodePtr a, xmlNodePtr b)
+{
+    int text_a = a->type == XML_TEXT_NODE || a->type == XML_CDATA_SECTION_NODE;
+    int text_b = b->type == XML_TEXT_NODE || b->type == XML_CDATA_SECTION_NODE;
+
+    if (text_a || text_b) return text_a && text_b;
+    if (a->type != b->type || !xmlStrEqual(patchName(a), patchName(b)))
+        return 0;
+    if (a->type != XML_ELEMENT_NODE) return 1;
+    return (!a->ns && !b->ns) ||
+        (a->ns && b->ns && xmlStrEqual(a->ns->href, b->ns->href));
+}
+
+/**
+ *  XPath of @node for the patch, as xmlGetNodePath() has it but with the
+ *  prefixes of patchPrefix(), which the patch's root declares
+ */
+static xmlChar*
+patchPath(xmlNodePtr node)
+{
+    xmlChar *path = NULL, *rest;
+    xmlNodePtr cur, sib;
+    char index[32];
+    int pos, count;
+
+    for (cur = node; cur && cur->type != XML_DOCUMENT_NODE; cur = cur->parent)
+    {
+        xmlChar *step;
+
+        switch (cur->type)
+        {
+            case XML_ELEMENT_NODE:
+            case XML_ATTRIBUTE_NODE:
+                step = xmlStrdup(cur->type == XML_ATTRIBUTE_NODE?
+                    BAD_CAST "/@" : BAD_CAST "/");
+                if (cur->ns)
+                {
+                    step = xmlStrcat(step, patchPrefix(cur->ns));
+                    step = xmlStrcat(step, BAD_CAST ":");
+                }
+                step = xmlStrcat(step, cur->name);
+                break;
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+                step = xmlStrdup(BAD_CAST "/text()");
+                break;
+            case XML_COMMENT_NODE:
+                step = xmlStrdup(BAD_CAST "/comment()");
+                break;
+            case XML_PI_NODE:
+                step = xmlStrdup(BAD_CAST "/processing-instruction('");
+                step = xmlStrcat(step, cur->name);
+                step = xmlStrcat(step, BAD_CAST "')");
+                break;
+            default:
+                xmlFree(path);
+                return xmlGetNodePath(node);
+        }
+
+        /* the position, unless no sibling has the same step */
+        if (cur->type != XML_ATTRIBUTE_NODE && cur->parent)
+        {
+            pos = count = 0;
+            for (sib = cur->parent->children; sib; sib = sib->next)
+            {
+                if (!patchSameStep(sib, cur)) continue;
+                count++;
+                if (sib == cur) pos = count;
+            }
+            if (count > 1)
+            {
+                sprintf(index, "[%d]", pos);
+                step = xmlStrcat(step, BAD_CAST index);
+            }
+        }
+
+        rest = path;
+        path = xmlStrcat(step, rest);
+        xmlFree(rest);
+    }
+    return path? path : xmlStrdup(BAD_CAST "/");
+}
+
+/**
+ *  record XUpdate instruction @name, selecting @path
+ */
+static xmlNodePtr
+patchCommand(const char *name, const xmlChar *path)
+{
+    xmlNodePtr root = xmlDocGetRootElement(patch);
+    xmlNodePtr cmd = xmlNewChild(root, root->ns, BAD_CAST name, NULL);
+    xmlNewProp(cmd, BAD_CAST "select", path);
+    return cmd;
+}
+
+/**
+ *  record XUpdate instruction @name, selecting @node in its current state
+ */
+static xmlNodePtr
+patchNode(const char *name, xmlNodePtr node)
+{
+    xmlNodePtr cmd;
+    xmlChar *path;
+
+    if (!patch) return NULL;
+    path = patchPath(node);
+    cmd = patchCommand(name, path);
+    xmlFree(path);
+    return cmd;
+}
+
+/**
+ *  add to @cmd the XUpdate content that rebuilds @node
+ */
+static void
+patchContent(xmlNodePtr cmd, xmlNodePtr node)
+{
+    xmlNsPtr xupdate = xmlDocGetRootElement(patch)->ns;
+    xmlNodePtr child, instr;
+    const xmlChar *name = node->name;
+    xmlChar *value;
+
+    switch (node->type)
+    {
+        case XML_ELEMENT_NODE:
+            instr = xmlDocCopyNode(node, patch, 2);
+            xmlAddChild(cmd, instr);
+            for (child = node->children; child; child = child->next)
+                patchContent(instr, child);
+            return;
+        case XML_ATTRIBUTE_NODE:
+            value = xmlNodeGetContent(node);
+            instr = xmlNewChild(cmd, xupdate, BAD_CAST "attribute", NULL);
+            xmlNodeAddContent(instr, value);
+            if (node->ns) {
+                xmlChar *qname = node->ns->prefix?
+                    xmlBuildQName(node->name, node->ns->prefix, NULL, 0) :
+                    xmlStrdup(node->name);
+                xmlNewProp(instr, BAD_CAST "name", qname);
+                xmlNewProp(instr, BAD_CAST "namespace", node->ns->href);
+                xmlFree(qname);
+            } else {
+                xmlNewProp(instr, BAD_CAST "name", name);
+            }
+            xmlFree(value);
+            return;
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+            name = BAD_CAST "text";
+            break;
+        case XML_COMMENT_NODE:
+            name = BAD_CAST "comment";
+            break;
+        case XML_PI_NODE:
+            instr = xmlNewChild(cmd, xupdate,
+                BAD_CAST "processing-instruction", NULL);
+            xmlNewProp(instr, BAD_CAST "name", node->name);
+            xmlNodeAddContent(instr, node->content);
+            return;
+        default:
+            return;
+    }
+    instr = xmlNewChild(cmd, xupdate, name, NULL);
+    xmlNodeAddContent(instr, node->content);
+}
+
+/**
+ *  record insertion of @node, which is already linked into the document
+ */
+static void
+patchInserted(xmlDocPtr doc, xmlNodePtr node)
+{
+    xmlNodePtr parent = node->parent, cur, cmd;
+    xmlChar *path;
+    char step[32];
+    int pos = 0;
+
+    if (!patch || !node) return;
+
+    if (node->type == XML_ATTRIBUTE_NODE || !node->next) {
+        cmd = patchNode("append", parent);
+    } else {
+        /* insert before the node that will follow it */
+        for (cur = node; cur; cur = cur->prev) {
+            if (cur->type != XML_DTD_NODE && cur->type != XML_ENTITY_REF_NODE)
+                pos++;
+        }
+        sprintf(step, "/node()[%d]", pos);
+        path = (parent == (xmlNodePtr) doc)? NULL : patchPath(parent);
+        path = xmlStrcat(path, BAD_CAST step);
+        cmd = patchCommand("insert-before", path);
+        xmlFree(path);
+    }
+    patchContent(cmd, node);
+}
+
+/**
+ *  record the new content of @node, updated by @cmd
+ */
+static void
+patchUpdated(xmlNodePtr cmd, xmlNodePtr node)
+{
+    xmlNodePtr child;
+    xmlChar *value, *path;
+
+    if (!cmd) return;
+
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_TEXT_NODE) break;
+    }
+    if (node->type != XML_ELEMENT_NODE || !child) {
+        value = xmlNodeGetContent(node);
+        xmlNodeAddContent(cmd, value);
+        xmlFree(value);
+        return;
+    }
+
+    /* can't be done with text: replace the children instead */
+    xmlNodeSetName(cmd, BAD_CAST "remove");
+    path = xmlGetProp(cmd, BAD_CAST "select");
+    cmd = patchCommand("append", path);
+    path = xmlStrcat(path, BAD_CAST "/node()");
+    xmlSetProp(cmd->prev, BAD_CAST "select", path);
+    xmlFree(path);
+    for (child = node->children; child; child = child->next)
+        patchContent(cmd, child);
+}
+
+/**
+ *  record the insertion of @node, which xmlAdd*() returned as @added: the
+ *  text node it was merged into, if it was text next to text
+ */
+static void
+patchAdded(xmlDocPtr doc, xmlNodePtr node, xmlNodePtr added)
+{
+    if (added != node)
+        patchUpdated(patchNode("update", added), added);
+    else
+        patchInserted(doc, added);
+}
+
 static void
 update_string(xmlDocPtr doc, xmlNodePtr dest, const xmlChar* newstr)
 {
@@ -256,6 +567,8 @@ edUpdate(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val,
 
     for (i = 0; i < nodes->nodeNr; i++)
     {
+        xmlNodePtr cmd = patchNode("update", nodes->nodeTab[i]);
+
         /* update node */
         if (type == XML_EXPR) {
             xmlXPathObjectPtr res;
@@ -305,6 +618,7 @@ edUpdate(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val,
         } else {
             update_string(doc, nodes->nodeTab[i], (const xmlChar*) val);
         }
+        patchUpdated(cmd, nodes->nodeTab[i]);
     }
 
     xmlXPathFreeCompExpr(xpath);
@@ -336,7 +650,7 @@ edInsert(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val, const char *name,
 
     for (i = 0; i < nodes->nodeNr; i++)
     {
-        xmlNodePtr node;
+        xmlNodePtr node, added;
 
         if (nodes->nodeTab[i] == (void*) doc && mode != 0) {
             fprintf(stderr, "The document node cannot have siblings.\n");
@@ -351,27 +665,223 @@ edInsert(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val, const char *name,
         else if (type == XML_ELEM)
         {
             node = xmlNewDocNode(doc, NULL /* TODO: NS */, BAD_CAST name, BAD_CAST val);
-            if (mode > 0)
-                xmlAddNextSibling(nodes->nodeTab[i], node);
-            else if (mode < 0)
-                xmlAddPrevSibling(nodes->nodeTab[i], node);
-            else
-                xmlAddChild(nodes->nodeTab[i], node);
         }
         else if (type == XML_TEXT)
         {
             node = xmlNewDocText(doc, BAD_CAST val);
+        }
+        added = node;
+        if (type == XML_ELEM || type == XML_TEXT)
+        {
+            /* text next to text is merged into it, and freed */
             if (mode > 0)
-                xmlAddNextSibling(nodes->nodeTab[i], node);
+                added = xmlAddNextSibling(nodes->nodeTab[i], node);
             else if (mode < 0)
-                xmlAddPrevSibling(nodes->nodeTab[i], node);
+                added = xmlAddPrevSibling(nodes->nodeTab[i], node);
             else
-                xmlAddChild(nodes->nodeTab[i], node);
+                added = xmlAddChild(nodes->nodeTab[i], node);
         }
+        xmlXPathNodeSetAdd(previous_insertion, added);
+        patchAdded(doc, node, added);
+    }
+}
+
+/**
+ *  evaluate @expr, using its compiled form @comp when there is one
+ */
+static xmlXPathObjectPtr
+edEval(xmlXPathCompExprPtr comp, const char *expr, xmlXPathContextPtr ctxt)
+{
+    if (comp)
+        return xmlXPathCompiledEval(comp, ctxt);
+    return xmlXPathEvalExpression(BAD_CAST expr, ctxt);
+}
+
+/**
+ *  parse XML fragment @val in the context of node @context
+ *  @returns element holding the parsed nodes, to be copied at each insertion
+ *  point
+ */
+static xmlNodePtr
+edParseFragment(xmlDocPtr doc, xmlNodePtr context, const char *val,
+    const edOptions* g_ops)
+{
+    xmlNodePtr cur, next, holder, list = NULL;
+    xmlParserErrors err;
+
+    /* names get interned in @doc's dictionary, so copying them is cheap */
+    err = xmlParseInNodeContext(context, val, strlen(val),
+        g_ops->nonet? XML_PARSE_NONET : 0, &list);
+    if (err != XML_ERR_OK) {
+        fprintf(stderr, "Malformed XML fragment\n");
+        exit(EXIT_BAD_ARGS);
+    }
+
+    holder = xmlNewDocNode(doc, NULL, BAD_CAST "fragment", NULL);
+    xmlAddChildList(holder, list);
+
+    /* the parser keeps blanks around the top-level nodes */
+    for (cur = holder->children; g_ops->noblanks && cur; cur = next) {
+        next = cur->next;
+        if (xmlIsBlankNode(cur)) {
+            xmlUnlinkNode(cur);
+            xmlFreeNode(cur);
+        }
+    }
+    return holder;
+}
+
+/**
+ *  replace namespace @from with @to in the subtree of @node
+ */
+static void
+edReplaceNs(xmlNodePtr node, xmlNsPtr from, xmlNsPtr to)
+{
+    xmlAttrPtr attr;
+    xmlNodePtr child;
+
+    if (node->type != XML_ELEMENT_NODE) return;
+    if (node->ns == from) node->ns = to;
+    for (attr = node->properties; attr; attr = attr->next)
+        if (attr->ns == from) attr->ns = to;
+    for (child = node->children; child; child = child->next)
+        edReplaceNs(child, from, to);
+}
+
+/**
+ *  drop the declarations the copy @node carries for the namespaces it
+ *  uses when its new parent has them in scope already
+ */
+static void
+edDropRedundantNs(xmlNodePtr node)
+{
+    xmlNsPtr *link, def, ns;
+
+    if (node->type != XML_ELEMENT_NODE || !node->parent) return;
+    for (link = &node->nsDef; (def = *link) != NULL; )
+    {
+        ns = xmlSearchNs(node->doc, node->parent, def->prefix);
+        if (ns && xmlStrEqual(ns->href, def->href)) {
+            edReplaceNs(node, def, ns);
+            *link = def->next;
+            xmlFreeNs(def);
+        } else {
+            link = &def->next;
+        }
+    }
+}
+
+/**
+ *  insert copies of @holder's attributes and children at @where
+ */
+static void
+edInsertFragmentAt(xmlDocPtr doc, xmlNodePtr where, xmlNodePtr holder,
+    int mode)
+{
+    xmlNodePtr cur, node, added;
+
+    if (where == (void*) doc && mode != 0) {
+        fprintf(stderr, "The document node cannot have siblings.\n");
+        exit(EXIT_INTERNAL_ERROR);
+    }
+
+    for (cur = (xmlNodePtr) holder->properties; cur; cur = cur->next)
+    {
+        if (mode != 0 || where->type != XML_ELEMENT_NODE) continue;
+        node = (xmlNodePtr) xmlCopyProp(where, (xmlAttrPtr) cur);
+        /* xmlAddChild() won't link a node that already has @where
+           as its parent, which xmlCopyProp() sets */
+        node->parent = NULL;
+        xmlAddChild(where, node);
         xmlXPathNodeSetAdd(previous_insertion, node);
+        patchInserted(doc, node);
+    }
+    for (cur = holder->children; cur; cur = cur->next)
+    {
+        node = xmlDocCopyNode(cur, doc, 1);
+        if (mode > 0)
+            where = added = xmlAddNextSibling(where, node);
+        else if (mode < 0)
+            added = xmlAddPrevSibling(where, node);
+        else
+            added = xmlAddChild(where, node);
+        edDropRedundantNs(added);
+        xmlXPathNodeSetAdd(previous_insertion, added);
+        patchAdded(doc, node, added);
     }
 }
 
+/**
+ *  'insert' operation with XML fragment: each insertion point gets its own
+ *  copy of @holder's attributes and children
+ */
+static void
+edInsertFragment(xmlDocPtr doc, xmlNodeSetPtr nodes, xmlNodePtr holder,
+    int mode)
+{
+    int i;
+
+    xmlXPathEmptyNodeSet(previous_insertion);
+    for (i = 0; holder && i < nodes->nodeNr; i++)
+        edInsertFragmentAt(doc, nodes->nodeTab[i], holder, mode);
+}
+
+/**
+ *  whether NULL terminated namespace lists from xmlGetNsList() are the
+ *  same bindings
+ */
+static int
+edSameNsList(xmlNsPtr *a, xmlNsPtr *b)
+{
+    if (a == NULL || b == NULL) return a == b;
+    while (*a && *a == *b) a++, b++;
+    return *a == *b;
+}
+
+/**
+ *  'insert' operation with XML fragment @val: it is parsed in the context
+ *  of each insertion point, as its prefixes may be bound differently
+ *  there, but parsed again only when the namespaces in scope change
+ */
+static void
+edInsertXml(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val, int mode,
+    const edOptions* g_ops)
+{
+    xmlNodePtr holder = NULL;
+    xmlNsPtr *scope = NULL;
+    int i;
+
+    xmlXPathEmptyNodeSet(previous_insertion);
+    if (nodes->nodeNr == 0) {
+        /* nothing to insert into, but a broken fragment is still an error */
+        xmlNodePtr root = xmlDocGetRootElement(doc);
+        xmlFreeNode(edParseFragment(doc, root? root : (xmlNodePtr) doc,
+            val, g_ops));
+        return;
+    }
+
+    for (i = 0; i < nodes->nodeNr; i++)
+    {
+        xmlNodePtr context = nodes->nodeTab[i];
+        xmlNsPtr *ns;
+
+        if (mode != 0 || context->type != XML_ELEMENT_NODE)
+            context = context->parent? context->parent : (xmlNodePtr) doc;
+        ns = xmlGetNsList(doc, context);
+        if (holder == NULL || !edSameNsList(ns, scope)) {
+            xmlFreeNode(holder);
+            holder = edParseFragment(doc, context, val, g_ops);
+            xmlFree(scope);
+            scope = ns;
+        } else {
+            xmlFree(ns);
+        }
+        edInsertFragmentAt(doc, nodes->nodeTab[i], holder, mode);
+    }
+    xmlFree(scope);
+    xmlFreeNode(holder);
+}
+
 /**
  *  'rename' operation
  */
@@ -385,6 +895,7 @@ edRename(xmlDocPtr doc, xmlNodeSetPtr nodes, const char *val, XmlNodeType type)
             fprintf(stderr, "The document node cannot be renamed.\n");
             exit(EXIT_INTERNAL_ERROR);
         }
+        xmlNodeAddContent(patchNode("rename", nodes->nodeTab[i]), BAD_CAST val);
         xmlNodeSetName(nodes->nodeTab[i], BAD_CAST val);
     }
 }
@@ -408,6 +919,7 @@ edDelete(xmlDocPtr doc, xmlNodeSetPtr nodes)
             exit(EXIT_INTERNAL_ERROR);
         }
         /* delete node */
+        patchNode("remove", nodes->nodeTab[i]);
         xmlUnlinkNode(nodes->nodeTab[i]);
 
         /* Free node and children */
@@ -422,6 +934,7 @@ edDelete(xmlDocPtr doc, xmlNodeSetPtr nodes)
 static void
 edMove(xmlDocPtr doc, xmlNodeSetPtr nodes, xmlNodePtr to)
 {
+    xmlNodePtr moved;
     int i;
     for (i = 0; i < nodes->nodeNr; i++)
     {
@@ -435,16 +948,159 @@ edMove(xmlDocPtr doc, xmlNodeSetPtr nodes, xmlNodePtr to)
             exit(EXIT_INTERNAL_ERROR);
         }
         /* move node */
+        patchNode("remove", nodes->nodeTab[i]);
         xmlUnlinkNode(nodes->nodeTab[i]);
-        xmlAddChild(to, nodes->nodeTab[i]);
+        moved = xmlAddChild(to, nodes->nodeTab[i]);
+        if (moved == nodes->nodeTab[i])
+            patchInserted(doc, moved);
+        else if (moved)         /* text was merged into the last child */
+            patchUpdated(patchNode("update", moved), moved);
+    }
+}
+
+/**
+ * can @op be applied during a tree walk shared with its neighbours?
+ *
+ * Only operations which don't create nodes qualify, and their target must be
+ * an absolute location path without predicates, so that it can be matched as
+ * an xmlPattern without looking at any other part of the tree.  Renames
+ * don't: a rename of an ancestor would change what matches below it, where
+ * one after the other all targets are found before any is renamed.
+ */
+static int
+edFusable(const XmlEdAction *op)
+{
+    const char *p;
+    int step_start = 1;
+
+    if (!(op->op == XML_ED_DELETE ||
+            (op->op == XML_ED_UPDATE && op->type == XML_TEXT)))
+        return 0;
+
+    p = op->arg1;
+    while (*p == ' ') p++;
+    if (*p != '/') return 0;
+    for (; *p; p++) {
+        if (strchr("[]()$\"'", *p) || (*p == ':' && p[1] == ':'))
+            return 0;
+        if (*p == '.' && step_start)
+            return 0;           /* "." and ".." steps */
+        if (*p == '|') {
+            while (p[1] == ' ') p++;
+            if (p[1] != '/') return 0;
+        }
+        step_start = (*p == '/' || *p == '|' || *p == '@');
     }
+    return 1;
+}
+
+typedef struct {
+    const xmlChar **namespaces; /* href, prefix pairs, NULL terminated */
+    int count;
+} NsPairs;
+
+static void
+collect_ns(void *href, void *data, const xmlChar *prefix)
+{
+    NsPairs *pairs = data;
+    pairs->namespaces[pairs->count++] = href;
+    pairs->namespaces[pairs->count++] = prefix;
+    pairs->namespaces[pairs->count] = NULL;
+}
+
+/**
+ *  apply each of @ops[@first..@last) whose @patterns match @node, then
+ *  continue with @node's attributes and children
+ */
+static void
+edWalk(xmlDocPtr doc, xmlNodePtr node, const XmlEdAction* ops,
+    xmlPatternPtr *patterns, int first, int last, xmlXPathContextPtr ctxt)
+{
+    int k;
+    xmlNodePtr cur, next;
+    xmlNodeSet single;
+
+    single.nodeNr = single.nodeMax = 1;
+    single.nodeTab = &node;
+
+    for (k = first; k < last; k++)
+    {
+        if (!xmlPatternMatch(patterns[k], node)) continue;
+        switch (ops[k].op)
+        {
+            case XML_ED_DELETE:
+                edDelete(doc, &single);
+                return;
+            case XML_ED_UPDATE:
+                edUpdate(doc, &single, ops[k].arg2, ops[k].type, ctxt);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (node->type != XML_ELEMENT_NODE) return;
+
+    for (cur = (xmlNodePtr) node->properties; cur; cur = next) {
+        next = cur->next;
+        edWalk(doc, cur, ops, patterns, first, last, ctxt);
+    }
+    for (cur = node->children; cur; cur = next) {
+        next = cur->next;
+        if (cur->type == XML_ELEMENT_NODE)
+            edWalk(doc, cur, ops, patterns, first, last, ctxt);
+    }
+}
+
+/**
+ *  Perform @ops[@first..] with a single tree walk, as long as they are fusable
+ *  @returns index of first operation not performed
+ */
+static int
+edProcessFused(xmlDocPtr doc, const XmlEdAction* ops, int first, int ops_count,
+    xmlXPathContextPtr ctxt)
+{
+    int k, last;
+    NsPairs ns;
+    xmlPatternPtr *patterns = xmlMalloc(sizeof(xmlPatternPtr) * ops_count);
+    xmlNodePtr cur, next;
+
+    ns.count = 0;
+    ns.namespaces = xmlMalloc(sizeof(xmlChar*) *
+        (2 * xmlHashSize(ctxt->nsHash) + 1));
+    ns.namespaces[0] = NULL;
+    xmlHashScan(ctxt->nsHash, collect_ns, &ns);
+
+    for (last = first; last < ops_count; last++)
+    {
+        if (!edFusable(&ops[last])) break;
+        patterns[last] = xmlPatterncompile(BAD_CAST ops[last].arg1,
+            doc->dict, XML_PATTERN_XPATH, ns.namespaces);
+        if (!patterns[last]) break;
+    }
+
+    if (last - first > 1) {
+        for (cur = doc->children; cur; cur = next) {
+            next = cur->next;
+            if (cur->type == XML_ELEMENT_NODE)
+                edWalk(doc, cur, ops, patterns, first, last, ctxt);
+        }
+    }
+
+    for (k = first; k < last; k++)
+        xmlFreePattern(patterns[k]);
+    xmlFree(patterns);
+    xmlFree(ns.namespaces);
+    /* a single operation is not worth it, leave it to XPath */
+    return (last - first > 1)? last : first;
 }
 
 /**
  *  Loop through array of operations and perform them
  */
 static void
-edProcess(xmlDocPtr doc, const XmlEdAction* ops, int ops_count)
+edProcess(xmlDocPtr doc, const XmlEdAction* ops, int ops_count,
+    const edOptions* g_ops)
 {
     int k;
     xmlXPathContextPtr ctxt = xmlXPathNewContext(doc);
@@ -474,18 +1130,25 @@ edProcess(xmlDocPtr doc, const XmlEdAction* ops, int ops_count)
     {
         xmlXPathObjectPtr res;
         xmlNodeSetPtr nodes;
+        int fused_end;
 
         /* NOTE: to make relative paths match as if from "/", set context to
            document; setting to root would match as if from "/node()/" */
         ctxt->node = (xmlNodePtr) doc;
 
+        fused_end = edProcessFused(doc, ops, k, ops_count, ctxt);
+        if (fused_end > k) {
+            k = fused_end - 1;
+            continue;
+        }
+
         if (ops[k].op == XML_ED_VAR) {
-            res = xmlXPathEvalExpression(BAD_CAST ops[k].arg2, ctxt);
+            res = edEval(ops[k].xpath, ops[k].arg2, ctxt);
             xmlXPathRegisterVariable(ctxt, BAD_CAST ops[k].arg1, res);
             continue;
         }
 
-        res = xmlXPathEvalExpression(BAD_CAST ops[k].arg1, ctxt);
+        res = edEval(ops[k].xpath, ops[k].arg1, ctxt);
         if (!res || res->type != XPATH_NODESET || !res->nodesetval) continue;
         nodes = res->nodesetval;
 
@@ -515,14 +1178,21 @@ edProcess(xmlDocPtr doc, const XmlEdAction* ops, int ops_count)
                 edRename(doc, nodes, ops[k].arg2, ops[k].type);
                 break;
             case XML_ED_INSERT:
-                edInsert(doc, nodes, ops[k].arg2, ops[k].arg3, ops[k].type, -1);
-                break;
             case XML_ED_APPEND:
-                edInsert(doc, nodes, ops[k].arg2, ops[k].arg3, ops[k].type, 1);
-                break;
-            case XML_ED_SUBNODE:
-                edInsert(doc, nodes, ops[k].arg2, ops[k].arg3, ops[k].type, 0);
+            case XML_ED_SUBNODE: {
+                int mode =
+                    (ops[k].op == XML_ED_INSERT)? -1 :
+                    (ops[k].op == XML_ED_APPEND)? 1 : 0;
+                if (ops[k].content) {
+                    edInsertFragment(doc, nodes, ops[k].content, mode);
+                } else if (ops[k].type == XML_FRAG) {
+                    edInsertXml(doc, nodes, ops[k].arg2, mode, g_ops);
+                } else {
+                    edInsert(doc, nodes, ops[k].arg2, ops[k].arg3,
+                        ops[k].type, mode);
+                }
                 break;
+            }
             default:
                 break;
         }
@@ -535,13 +1205,31 @@ edProcess(xmlDocPtr doc, const XmlEdAction* ops, int ops_count)
     xmlXPathFreeContext(ctxt);
 }
 
+/**
+ *  copy @doc for a variant; the copy shares @doc's dictionary, so names
+ *  aren't duplicated and compare equal by pointer
+ */
+static xmlDocPtr
+edCopyDoc(xmlDocPtr doc)
+{
+    xmlDocPtr copy = xmlCopyDoc(doc, 0);
+
+    if (doc->dict) {
+        copy->dict = doc->dict;
+        xmlDictReference(copy->dict);
+    }
+    xmlAddChildList((xmlNodePtr) copy, xmlDocCopyNodeList(copy, doc->children));
+    return copy;
+}
+
 /**
  *  Output document
  */
 static void
 edOutput(const char* filename, const XmlEdAction* ops, int ops_count,
-    const edOptions* g_ops)
+    const XmlEdVariant* variants, int variants_count, const edOptions* g_ops)
 {
+    int v;
     xmlDocPtr doc;
     int save_options =
 #if LIBXML_VERSION >= 20708
@@ -562,7 +1250,40 @@ edOutput(const char* filename, const XmlEdAction* ops, int ops_count,
         exit(EXIT_BAD_FILE);
     }
 
-    edProcess(doc, ops, ops_count);
+    if (g_ops->patch_out) {
+        xmlNodePtr root = xmlNewDocNode(patch = xmlNewDoc(BAD_CAST "1.0"),
+            NULL, BAD_CAST "modifications", NULL);
+        xmlDocSetRootElement(patch, root);
+        xmlSetNs(root, xmlNewNs(root, BAD_CAST XUPDATE_NS, BAD_CAST "xupdate"));
+        xmlNewProp(root, BAD_CAST "version", BAD_CAST "1.0");
+    }
+
+    edProcess(doc, ops, variants_count? variants[0].first : ops_count, g_ops);
+
+    if (patch) {
+        save = xmlSaveToFilename(g_ops->patch_out, NULL, XML_SAVE_FORMAT);
+        xmlSaveDoc(save, patch);
+        xmlSaveClose(save);
+        xmlFreeDoc(patch);
+        patch = NULL;
+    }
+
+    /* each variant edits its own copy of the document parsed once */
+    for (v = 0; v < variants_count; v++)
+    {
+        xmlDocPtr copy = edCopyDoc(doc);
+        edProcess(copy, ops + variants[v].first, variants[v].count, g_ops);
+        save = xmlSaveToFilename(variants[v].output, NULL, save_options);
+        xmlSaveDoc(save, copy);
+        xmlSaveClose(save);
+        xmlFreeDoc(copy);
+    }
+
+    if (g_ops->patch_out) {
+        /* the changes stand in for the document */
+        xmlFreeDoc(doc);
+        return;
+    }
 
     /* avoid getting ASCII CRs in UTF-16/UCS-(2,4) text */
     if ((xmlStrcasestr(doc->encoding, BAD_CAST "UTF") == 0
@@ -620,6 +1341,31 @@ parseNextArg(char *const*const argv, int *argi,
     parseNextArg(argv, argi, choices, COUNT_OF(choices))
 
 
+/**
+ * read whole contents of @filename into a NUL terminated buffer
+ */
+static xmlChar*
+readFile(const char *filename)
+{
+    FILE *f = strcmp(filename, "-")? fopen(filename, "rb") : stdin;
+    xmlChar *buf = NULL;
+    int len = 0, size = 0;
+
+    if (!f) {
+        fprintf(stderr, "couldn't read file '%s'\n", filename);
+        exit(EXIT_BAD_FILE);
+    }
+    do {
+        size = size? size * 2 : 4096;
+        buf = xmlRealloc(buf, size);
+        len += fread(buf + len, 1, size - len - 1, f);
+    } while (len == size - 1);
+    buf[len] = '\0';
+
+    if (f != stdin) fclose(f);
+    return buf;
+}
+
 /** --insert, --append, and --subnode all take the same arguments */
 static void
 parseInsertionArgs(XmlEdOp op_type, XmlEdAction* op,
@@ -630,10 +1376,25 @@ parseInsertionArgs(XmlEdOp op_type, XmlEdAction* op,
     op->arg1 = nextArg(argv, argi);
     parseNextArg(argv, argi, OPT_JUST_TYPE);
     op->type = parseNextArg(argv, argi, OPT_NODE_TYPE);
+    op->arg2 = 0;
+    op->arg3 = 0;
+    if (op->type == XML_FRAG)
+    {
+        /* the fragment brings its own names */
+        arg = nextArg(argv, argi);
+        if (!strcmp(arg, "--value-file")) {
+            op->buf = readFile(nextArg(argv, argi));
+            op->arg2 = (const char*) op->buf;
+        } else {
+            (*argi)--;
+            parseNextArg(argv, argi, OPT_JUST_VAL);
+            op->arg2 = nextArg(argv, argi);
+        }
+        return;
+    }
     parseNextArg(argv, argi, OPT_JUST_NAME);
     op->arg3 = nextArg(argv, argi);
     /* test if value is given */
-    op->arg2 = 0;
     arg = argv[*argi];
     if (!arg) return;
     if (!strcmp(arg, "-v") || !strcmp(arg, "--value")) {
@@ -642,6 +1403,332 @@ parseInsertionArgs(XmlEdOp op_type, XmlEdAction* op,
     }
 }
 
+static xmlDocPtr xupdate_content = NULL;   /* owns the --xupdate holders */
+
+/**
+ *  report error in XUpdate script @node and exit
+ */
+static void
+xupError(xmlNodePtr node, const char *msg)
+{
+    fprintf(stderr, "%s:%ld: %s <%s>\n", node->doc->URL,
+        xmlGetLineNo(node), msg, node->name);
+    exit(EXIT_BAD_ARGS);
+}
+
+/**
+ *  @returns non-zero if @node is the XUpdate element @name
+ */
+static int
+xupIs(xmlNodePtr node, const char *name)
+{
+    return node->type == XML_ELEMENT_NODE && node->ns &&
+        xmlStrEqual(node->ns->href, BAD_CAST XUPDATE_NS) &&
+        (!name || xmlStrEqual(node->name, BAD_CAST name));
+}
+
+/**
+ *  get required attribute @name of XUpdate element @node
+ */
+static xmlChar*
+xupAttr(xmlNodePtr node, const char *name)
+{
+    xmlChar *val = xmlGetNoNsProp(node, BAD_CAST name);
+    if (!val) {
+        fprintf(stderr, "%s:%ld: <%s> needs a '%s' attribute\n",
+            node->doc->URL, xmlGetLineNo(node), node->name, name);
+        exit(EXIT_BAD_ARGS);
+    }
+    return val;
+}
+
+/**
+ *  add element (or attribute, if @value is given) @name to @parent, in
+ *  namespace @href, reusing a declaration in scope where there is one
+ */
+static xmlNodePtr
+xupAddNamed(xmlNodePtr parent, const xmlChar *name, const xmlChar *href,
+    const xmlChar *prefix, const xmlChar *value)
+{
+    xmlNodePtr node, owner;
+    xmlNsPtr ns;
+
+    if (value)
+        node = (xmlNodePtr) xmlNewDocProp(xupdate_content, name, value);
+    else
+        node = xmlNewDocNode(xupdate_content, NULL, name, NULL);
+    xmlAddChild(parent, node);
+
+    if (href) {
+        /* declare it on the element carrying the name */
+        owner = value? parent : node;
+        ns = xmlSearchNsByHref(xupdate_content, owner, href);
+        if (!ns || (value && !ns->prefix) || !xmlStrEqual(ns->prefix, prefix))
+            ns = xmlNewNs(owner, href, prefix);
+        xmlSetNs(node, ns);
+    }
+    return node;
+}
+
+/**
+ *  add element or attribute named by the 'name' attribute of XUpdate
+ *  instruction @from, resolving its prefix in the script
+ */
+static xmlNodePtr
+xupAddComputed(xmlNodePtr from, xmlNodePtr parent, const xmlChar *value)
+{
+    xmlChar *qname = xupAttr(from, "name");
+    xmlChar *prefix = NULL, *href;
+    xmlChar *local = xmlSplitQName2(qname, &prefix);
+    xmlNodePtr node;
+
+    href = xmlGetNoNsProp(from, BAD_CAST "namespace");
+    if (!href && (prefix || !value)) {
+        xmlNsPtr def = xmlSearchNs(from->doc, from, prefix);
+        if (def && !xmlStrEqual(def->href, BAD_CAST XUPDATE_NS))
+            href = xmlStrdup(def->href);
+        else if (prefix)
+            xupError(from, "undeclared namespace prefix in");
+    }
+    node = xupAddNamed(parent, local? local : qname, href, prefix, value);
+
+    xmlFree(prefix);
+    xmlFree(local);
+    xmlFree(href);
+    xmlFree(qname);
+    return node;
+}
+
+/**
+ *  build the nodes described by XUpdate content @list under @parent
+ */
+static void
+xupBuildContent(xmlNodePtr parent, xmlNodePtr list)
+{
+    xmlNodePtr cur, node;
+    xmlAttrPtr attr;
+    xmlChar *value;
+
+    for (cur = list; cur; cur = cur->next)
+    {
+        if (cur->type == XML_TEXT_NODE || cur->type == XML_CDATA_SECTION_NODE) {
+            if (xmlIsBlankNode(cur)) continue;
+            xmlAddChild(parent, xmlDocCopyNode(cur, xupdate_content, 1));
+        } else if (cur->type != XML_ELEMENT_NODE) {
+            continue;
+        } else if (xupIs(cur, "element")) {
+            node = xupAddComputed(cur, parent, NULL);
+            xupBuildContent(node, cur->children);
+        } else if (xupIs(cur, "attribute")) {
+            /* goes to properties, even on the holder */
+            value = xmlNodeGetContent(cur);
+            xupAddComputed(cur, parent, value);
+            xmlFree(value);
+        } else if (xupIs(cur, "text")) {
+            value = xmlNodeGetContent(cur);
+            xmlAddChild(parent, xmlNewDocText(xupdate_content, value));
+            xmlFree(value);
+        } else if (xupIs(cur, "comment")) {
+            value = xmlNodeGetContent(cur);
+            xmlAddChild(parent, xmlNewDocComment(xupdate_content, value));
+            xmlFree(value);
+        } else if (xupIs(cur, "processing-instruction")) {
+            xmlChar *target = xupAttr(cur, "name");
+            value = xmlNodeGetContent(cur);
+            xmlAddChild(parent, xmlNewDocPI(xupdate_content, target, value));
+            xmlFree(value);
+            xmlFree(target);
+        } else if (xupIs(cur, NULL)) {
+            xupError(cur, "unsupported XUpdate content");
+        } else {
+            /* literal result element */
+            node = xupAddNamed(parent, cur->name,
+                cur->ns? cur->ns->href : NULL,
+                cur->ns? cur->ns->prefix : NULL, NULL);
+            for (attr = cur->properties; attr; attr = attr->next) {
+                value = xmlNodeGetContent((xmlNodePtr) attr);
+                xupAddNamed(node, attr->name,
+                    attr->ns? attr->ns->href : NULL,
+                    attr->ns? attr->ns->prefix : NULL, value);
+                xmlFree(value);
+            }
+            xupBuildContent(node, cur->children);
+        }
+    }
+}
+
+/**
+ *  keep @s1 and @s2 in storage owned by @op, they become arg1 and arg2
+ */
+static void
+xupSetArgs(XmlEdAction *op, const xmlChar *s1, const xmlChar *s2)
+{
+    int len1 = xmlStrlen(s1), len2 = xmlStrlen(s2);
+
+    op->buf = xmlMalloc(len1 + len2 + 2);
+    memcpy(op->buf, s1, len1 + 1);
+    if (s2) memcpy(op->buf + len1 + 1, s2, len2 + 1);
+    else op->buf[len1 + 1] = '\0';
+    op->arg1 = (const char*) op->buf;
+    op->arg2 = (const char*) op->buf + len1 + 1;
+}
+
+/**
+ *  compile XUpdate script @filename into operations appended to @ops, the
+ *  script's namespace prefixes are made available to the XPath expressions
+ */
+static void
+edLoadXUpdate(const char *filename, XmlEdAction **ops, int *ops_count,
+    int *max_ops_count)
+{
+    xmlDocPtr script;
+    xmlNodePtr root, cmd;
+    xmlNsPtr ns;
+    int n;
+
+    script = xmlReadFile(filename, NULL, XML_PARSE_NONET);
+    if (!script) {
+        fprintf(stderr, "couldn't read file '%s'\n", filename);
+        exit(EXIT_BAD_FILE);
+    }
+    root = xmlDocGetRootElement(script);
+    if (!root || !xupIs(root, "modifications")) {
+        fprintf(stderr, "%s: not an XUpdate script\n", filename);
+        exit(EXIT_BAD_ARGS);
+    }
+
+    for (n = 0; ns_arr[n]; n++)
+        ;
+    for (ns = root->nsDef; ns; ns = ns->next)
+    {
+        if (!ns->prefix || xmlStrEqual(ns->href, BAD_CAST XUPDATE_NS))
+            continue;
+        if (n + 2 > 2 * MAX_NS_ARGS) {
+            fprintf(stderr, "too many namespaces increase MAX_NS_ARGS\n");
+            exit(EXIT_BAD_ARGS);
+        }
+        ns_arr[n++] = xmlStrdup(ns->prefix);
+        ns_arr[n++] = xmlStrdup(ns->href);
+        ns_arr[n] = 0;
+    }
+
+    if (!xupdate_content)
+        xupdate_content = xmlNewDoc(BAD_CAST "1.0");
+
+    for (cmd = root->children; cmd; cmd = cmd->next)
+    {
+        XmlEdAction *op;
+        xmlChar *select, *value;
+
+        if (cmd->type != XML_ELEMENT_NODE) continue;
+        if (!xupIs(cmd, NULL)) xupError(cmd, "unexpected element");
+
+        if (*ops_count >= *max_ops_count)
+        {
+            *max_ops_count *= 2;
+            *ops = xmlRealloc(*ops, sizeof(XmlEdAction) * *max_ops_count);
+        }
+        op = &(*ops)[*ops_count];
+        op->arg3 = 0;
+        op->type = XML_UNDEFINED;
+        op->content = NULL;
+        op->xpath = NULL;
+
+        if (xupIs(cmd, "variable")) {
+            op->op = XML_ED_VAR;
+            select = xupAttr(cmd, "select");
+            value = xupAttr(cmd, "name");
+            xupSetArgs(op, value, select);
+            xmlFree(value);
+            xmlFree(select);
+            (*ops_count)++;
+            continue;
+        }
+
+        select = xupAttr(cmd, "select");
+        value = NULL;
+        if (xupIs(cmd, "remove")) {
+            op->op = XML_ED_DELETE;
+        } else if (xupIs(cmd, "update")) {
+            op->op = XML_ED_UPDATE;
+            op->type = XML_TEXT;
+            value = xmlNodeGetContent(cmd);
+        } else if (xupIs(cmd, "rename")) {
+            op->op = XML_ED_RENAME;
+            op->type = XML_TEXT;
+            value = xmlNodeGetContent(cmd);
+        } else if (xupIs(cmd, "insert-before") || xupIs(cmd, "insert-after") ||
+                   xupIs(cmd, "append")) {
+            op->op = xupIs(cmd, "append")? XML_ED_SUBNODE :
+                xupIs(cmd, "insert-before")? XML_ED_INSERT : XML_ED_APPEND;
+            op->type = XML_FRAG;
+            op->content =
+                xmlNewDocNode(xupdate_content, NULL, BAD_CAST "content", NULL);
+            xupBuildContent(op->content, cmd->children);
+        } else {
+            xupError(cmd, "unsupported XUpdate operation");
+        }
+        xupSetArgs(op, select, value);
+        xmlFree(value);
+        xmlFree(select);
+        (*ops_count)++;
+    }
+    xmlFreeDoc(script);
+}
+
+static void
+edIgnoreError(void *ctx, xmlErrorPtr error)
+{
+    /* do nothing */
+}
+
+/**
+ *  compile the XPath expressions of @ops once, instead of once per file;
+ *  an expression that fails to compile is left to report its error when
+ *  evaluated, as before
+ */
+static void
+edCompileOps(XmlEdAction *ops, int ops_count)
+{
+    void *error_ctxt = xmlStructuredErrorContext;
+    xmlStructuredErrorFunc error_func = xmlStructuredError;
+    int k;
+
+    xmlSetStructuredErrorFunc(NULL, edIgnoreError);
+    for (k = 0; k < ops_count; k++)
+    {
+        ops[k].xpath = xmlXPathCompile(BAD_CAST
+            (ops[k].op == XML_ED_VAR? ops[k].arg2 : ops[k].arg1));
+    }
+    xmlSetStructuredErrorFunc(error_ctxt, error_func);
+}
+
+/**
+ *  order @ops so that the document's come first, followed by those of
+ *  each variant in turn, and record where each variant's actions are
+ */
+static XmlEdAction*
+edGroupVariants(XmlEdAction *ops, int ops_count,
+    XmlEdVariant *variants, int variants_count)
+{
+    XmlEdAction *grouped;
+    int v, k, n = 0;
+
+    if (!variants_count) return ops;
+
+    grouped = xmlMalloc(sizeof(XmlEdAction) * ops_count);
+    for (v = 0; v <= variants_count; v++)
+    {
+        if (v > 0) variants[v-1].first = n;
+        for (k = 0; k < ops_count; k++) {
+            if (ops[k].variant == v) grouped[n++] = ops[k];
+        }
+        if (v > 0) variants[v-1].count = n - variants[v-1].first;
+    }
+    xmlFree(ops);
+    return grouped;
+}
+
 /**
  *  This is the main function for 'edit' option
  */
@@ -650,6 +1737,8 @@ edMain(int argc, char **argv)
 {
     int i, ops_count, max_ops_count = 8, n, start = 0;
     XmlEdAction* ops = xmlMalloc(sizeof(XmlEdAction) * max_ops_count);
+    int variant = 0, variants_count = 0, max_variants_count = 0;
+    XmlEdVariant* variants = NULL;
     static edOptions g_ops;
     int nCount = 0;
 
@@ -669,6 +1758,31 @@ edMain(int argc, char **argv)
     while (i < argc)
     {
         const char *arg = nextArg(argv, &i);
+        if (!strcmp(arg, "--variant"))
+        {
+            if (variants_count >= max_variants_count)
+            {
+                max_variants_count = max_variants_count? 2*max_variants_count : 4;
+                variants = xmlRealloc(variants,
+                    sizeof(XmlEdVariant) * max_variants_count);
+            }
+            variants[variants_count].output = nextArg(argv, &i);
+            variant = ++variants_count;
+            continue;
+        }
+        if (!strcmp(arg, "--") && variant)
+        {
+            variant = 0;
+            continue;
+        }
+        if (!strcmp(arg, "--xupdate"))
+        {
+            n = ops_count;
+            edLoadXUpdate(nextArg(argv, &i), &ops, &ops_count, &max_ops_count);
+            for (; n < ops_count; n++)
+                ops[n].variant = variant;
+            continue;
+        }
         if (arg[0] == '-')
         {
             if (ops_count >= max_ops_count)
@@ -677,6 +1791,10 @@ edMain(int argc, char **argv)
                 ops = xmlRealloc(ops, sizeof(XmlEdAction) * max_ops_count);
             }
             ops[ops_count].type = XML_UNDEFINED;
+            ops[ops_count].buf = NULL;
+            ops[ops_count].content = NULL;
+            ops[ops_count].xpath = NULL;
+            ops[ops_count].variant = variant;
 
             if (!strcmp(arg, "-d") || !strcmp(arg, "--delete"))
             {
@@ -735,21 +1853,41 @@ edMain(int argc, char **argv)
         }
     }
 
+    edCompileOps(ops, ops_count);
+
+    if (g_ops.patch_out && (g_ops.inplace || argc - i > 1))
+    {
+        fprintf(stderr, "--patch-out takes a single input, without -L\n");
+        exit(EXIT_BAD_ARGS);
+    }
+    if (variants_count && argc - i > 1)
+    {
+        fprintf(stderr, "--variant takes a single input\n");
+        exit(EXIT_BAD_ARGS);
+    }
+    ops = edGroupVariants(ops, ops_count, variants, variants_count);
+
     xmlKeepBlanksDefault(0);
 
     if ((!g_ops.noblanks) || g_ops.preserveFormat) xmlKeepBlanksDefault(1);
 
     if (i >= argc)
     {
-        edOutput("-", ops, ops_count, &g_ops);
+        edOutput("-", ops, ops_count, variants, variants_count, &g_ops);
     }
     
     for (n=i; n<argc; n++)
     {
-        edOutput(argv[n], ops, ops_count, &g_ops);
+        edOutput(argv[n], ops, ops_count, variants, variants_count, &g_ops);
     }
 
+    for (n = 0; n < ops_count; n++) {
+        xmlFree(ops[n].buf);
+        if (ops[n].xpath) xmlXPathFreeCompExpr(ops[n].xpath);
+    }
     xmlFree(ops);
+    xmlFree(variants);
+    if (xupdate_content) xmlFreeDoc(xupdate_content);
     cleanupNSArr(ns_arr);
     xmlCleanupParser();
     xmlCleanupGlobals();
@@ -30,34 +30,89 @@ THE SOFTWARE.
 
 #include <libxml/xmlstring.h>
 #include <libxml/hash.h>
+#include <libxml/pattern.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "xmlstar.h"
 #include "escape.h"
-
-/* TODO:
-
-   2. Option to display this only for nodes matching
-      an XPATH expression
-
-      -p <xpath>
-
-      so it will be able to deal with subtrees as well
-
-*/
+#include "digest.h"
+#include "infer.h"
 
 typedef struct _elOptions {
     int show_attr;            /* show attributes */
     int show_attr_and_val;    /* show attributes and values */
     int sort_uniq;            /* do sort and uniq on output */
     int check_depth;          /* limit depth */
+    int stats;                /* collect per path statistics */
+    const char *pattern;      /* only show subtrees matching it */
 } elOptions;
 
 
 static elOptions elOps;
-static xmlHashTablePtr uniq = NULL;
-static xmlChar *curXPath = NULL;
+static InferModel *inferModel = NULL;   /* for --infer */
+
+/*
+ *  el --stats keeps one record per distinct path; values are hashed as
+ *  they stream by and counted with a HyperLogLog sketch, so memory does
+ *  not grow with the size of the document
+ */
+
+#define EL_HLL_BITS 10
+#define EL_HLL_SIZE (1 << EL_HLL_BITS)   /* standard error about 3% */
+
+typedef struct _elValueStat {
+    unsigned long count;        /* occurrences carrying a value */
+    unsigned long min_len;      /* value lengths, in characters */
+    unsigned long max_len;
+    unsigned char *hll;         /* sketch registers, made by the 1st value */
+} elValueStat;
+
+typedef struct _elStat {
+    unsigned long count;        /* occurrences of the element */
+    elValueStat text;           /* text content of the element */
+    xmlHashTablePtr attrs;      /* attribute name -> elValueStat */
+} elStat;
+
+typedef struct _elStatFrame {
+    elStat *stat;
+    int has_text;
+    unsigned long len;
+    xxh64State hash;
+} elStatFrame;
+
+static elStatFrame *statFrames = NULL;  /* open elements, by depth */
+static int statFramesSize = 0;
+
+/*
+ *  Paths are interned in a trie: a node is found from its parent's id and
+ *  the element name as interned in the reader's dictionary, so moving to
+ *  a child costs the same at any depth. Path strings are only built for
+ *  output, once per distinct path.
+ */
+
+typedef struct _elPathNode {
+    int parent;                 /* -1 for the document element */
+    int depth;
+    const xmlChar *key;         /* name from the reader's dictionary */
+    xmlChar *name;
+    xmlChar *path;              /* full path, built on demand */
+    int seen;                   /* reported, for -u and -d<n> */
+    elStat *stat;               /* for --stats */
+} elPathNode;
+
+typedef struct _elPaths {
+    elPathNode *nodes;
+    int count, size;
+    int *index;                 /* open addressing, -1 is free */
+    unsigned long indexSize;
+    int *stack;                 /* open elements, by depth */
+    int stackSize;
+} elPaths;
 
 /**
  *  Display usage syntax
@@ -73,62 +128,442 @@ elUsage(int argc, char **argv, exit_status status)
     exit(status);
 }
 
+static unsigned long
+elPathHash(int parent, const xmlChar *key)
+{
+    unsigned long h = (unsigned long) key;
+    h ^= h >> 9;
+    h += (unsigned long) (parent + 1) * 2654435761UL;
+    return h ^ (h >> 16);
+}
+
 /**
- *  read file and print element paths
+ *  find or add the child of node @parent named @key
  */
-int
-parse_xml_file(const char *filename)
+static int
+elPathChild(elPaths *paths, int parent, const xmlChar *key, int depth)
 {
-    int ret, prev_depth = 0;
-    xmlTextReaderPtr reader;
+    unsigned long h, mask;
+    elPathNode *node;
+    int id;
 
-    for (reader = xmlReaderForFile(filename, NULL, 0);;)
+    if ((unsigned long) (paths->count + 1) * 2 > paths->indexSize)
     {
-        int depth;
-        const xmlChar *name;
-        xmlReaderTypes type;
+        unsigned long size = paths->indexSize? paths->indexSize * 2 : 256;
+        xmlFree(paths->index);
+        paths->index = xmlMalloc(size * sizeof(int));
+        memset(paths->index, -1, size * sizeof(int));
+        paths->indexSize = size;
+        for (id = 0; id < paths->count; id++)
+        {
+            h = elPathHash(paths->nodes[id].parent, paths->nodes[id].key);
+            while (paths->index[h & (size - 1)] >= 0) h++;
+            paths->index[h & (size - 1)] = id;
+        }
+    }
+
+    mask = paths->indexSize - 1;
+    for (h = elPathHash(parent, key) & mask; paths->index[h] >= 0;
+         h = (h + 1) & mask)
+    {
+        node = &paths->nodes[paths->index[h]];
+        if (node->key == key && node->parent == parent)
+            return paths->index[h];
+    }
+
+    if (paths->count == paths->size)
+    {
+        paths->size = paths->size? paths->size * 2 : 64;
+        paths->nodes = xmlRealloc(paths->nodes, paths->size * sizeof(elPathNode));
+    }
+    id = paths->index[h] = paths->count++;
+    node = &paths->nodes[id];
+    memset(node, 0, sizeof(elPathNode));
+    node->parent = parent;
+    node->depth = depth;
+    node->key = key;
+    node->name = xmlStrdup(key);
+    return id;
+}
+
+/**
+ *  enter element @key at @depth, return its node id
+ */
+static int
+elPathPush(elPaths *paths, const xmlChar *key, int depth)
+{
+    if (depth >= paths->stackSize)
+    {
+        paths->stackSize = paths->stackSize? paths->stackSize * 2 : 32;
+        while (paths->stackSize <= depth) paths->stackSize *= 2;
+        paths->stack = xmlRealloc(paths->stack, paths->stackSize * sizeof(int));
+    }
+    paths->stack[depth] = elPathChild(paths,
+        depth > 0? paths->stack[depth - 1] : -1, key, depth);
+    return paths->stack[depth];
+}
+
+/**
+ *  return the path of node @id, building it if needed
+ */
+static const xmlChar *
+elPath(elPaths *paths, int id)
+{
+    elPathNode *node = &paths->nodes[id];
+
+    if (!node->path)
+    {
+        if (node->parent < 0)
+            node->path = xmlStrdup(node->name);
+        else
+        {
+            const xmlChar *ppath = elPath(paths, node->parent);
+            int plen = xmlStrlen(ppath), len = xmlStrlen(node->name);
+
+            node->path = xmlMalloc(plen + len + 2);
+            memcpy(node->path, ppath, plen);
+            node->path[plen] = '/';
+            memcpy(node->path + plen + 1, node->name, len + 1);
+        }
+    }
+    return node->path;
+}
+
+/**
+ *  record a value with hash @hash and length @len
+ */
+static void
+elValueAdd(elValueStat *vs, uint64_t hash, unsigned long len)
+{
+    uint64_t rest = hash << EL_HLL_BITS;
+    int rank = 1;
+
+    if (!vs->hll)
+    {
+        vs->hll = xmlMalloc(EL_HLL_SIZE);
+        memset(vs->hll, 0, EL_HLL_SIZE);
+    }
+    if (vs->count == 0 || len < vs->min_len) vs->min_len = len;
+    if (len > vs->max_len) vs->max_len = len;
+    vs->count++;
 
-        if (!reader) {
-            fprintf(stderr, "couldn't read file '%s'\n", filename);
-            exit(EXIT_BAD_FILE);
+    /* register = position of the first 1 bit after the index bits */
+    while (rank <= 64 - EL_HLL_BITS && !(rest & ((uint64_t) 1 << 63)))
+    {
+        rank++;
+        rest <<= 1;
+    }
+    if (rank > vs->hll[hash >> (64 - EL_HLL_BITS)])
+        vs->hll[hash >> (64 - EL_HLL_BITS)] = rank;
+}
+
+/**
+ *  estimate the number of distinct values seen by @vs
+ */
+static unsigned long
+elValueDistinct(const elValueStat *vs)
+{
+    double m = EL_HLL_SIZE, sum = 0, est;
+    int i, zeros = 0;
+
+    if (!vs->hll) return 0;
+    for (i = 0; i < EL_HLL_SIZE; i++)
+    {
+        sum += ldexp(1.0, -vs->hll[i]);
+        if (!vs->hll[i]) zeros++;
+    }
+    est = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (est <= 2.5 * m && zeros)
+        est = m * log(m / zeros);   /* small range: linear counting */
+    if (est > vs->count) return vs->count;
+    return (unsigned long) (est + 0.5);
+}
+
+static void
+elValueStatFree(void *payload, const xmlChar *name)
+{
+    elValueStat *vs = payload;
+    xmlFree(vs->hll);
+    xmlFree(vs);
+}
+
+static void
+elStatFree(void *payload, const xmlChar *name)
+{
+    elStat *stat = payload;
+    if (stat->attrs) xmlHashFree(stat->attrs, elValueStatFree);
+    xmlFree(stat->text.hll);
+    xmlFree(stat);
+}
+
+static void
+elPathsFree(elPaths *paths)
+{
+    int id;
+
+    for (id = 0; id < paths->count; id++)
+    {
+        elPathNode *node = &paths->nodes[id];
+        xmlFree(node->name);
+        xmlFree(node->path);
+        if (node->stat) elStatFree(node->stat, NULL);
+    }
+    xmlFree(paths->nodes);
+    xmlFree(paths->index);
+    xmlFree(paths->stack);
+}
+
+/**
+ *  close the element open at @depth, recording its text
+ */
+static void
+elStatsEnd(int depth)
+{
+    elStatFrame *frame;
+
+    if (depth < 0 || depth >= statFramesSize) return;
+    frame = &statFrames[depth];
+    if (frame->stat && frame->has_text)
+        elValueAdd(&frame->stat->text, xxh64Final(&frame->hash), frame->len);
+    frame->stat = NULL;
+}
+
+/**
+ *  count the element the reader is on, whose path is node @id
+ */
+static void
+elStatsElement(xmlTextReaderPtr reader, elPathNode *node, int depth)
+{
+    elStat *stat = node->stat;
+    elStatFrame *frame;
+    int have_attr;
+
+    if (!stat)
+    {
+        stat = xmlMalloc(sizeof(elStat));
+        memset(stat, 0, sizeof(elStat));
+        node->stat = stat;
+    }
+    stat->count++;
+
+    for (have_attr = xmlTextReaderMoveToFirstAttribute(reader);
+         have_attr;
+         have_attr = xmlTextReaderMoveToNextAttribute(reader))
+    {
+        const xmlChar *aname = xmlTextReaderConstName(reader),
+            *avalue = xmlTextReaderConstValue(reader);
+        elValueStat *vs;
+
+        if (!stat->attrs) stat->attrs = xmlHashCreate(0);
+        vs = xmlHashLookup(stat->attrs, aname);
+        if (!vs)
+        {
+            vs = xmlMalloc(sizeof(elValueStat));
+            memset(vs, 0, sizeof(elValueStat));
+            xmlHashAddEntry(stat->attrs, aname, vs);
         }
+        elValueAdd(vs, xxh64(avalue, xmlStrlen(avalue), 0),
+            xmlUTF8Strlen(avalue));
+    }
+    xmlTextReaderMoveToElement(reader);
 
-        ret = xmlTextReaderRead(reader);
+    if (depth >= statFramesSize)
+    {
+        int size = statFramesSize? statFramesSize * 2 : 32;
+        while (size <= depth) size *= 2;
+        statFrames = xmlRealloc(statFrames, size * sizeof(elStatFrame));
+        memset(statFrames + statFramesSize, 0,
+            (size - statFramesSize) * sizeof(elStatFrame));
+        statFramesSize = size;
+    }
+    frame = &statFrames[depth];
+    frame->stat = stat;
+    frame->has_text = 0;
+    frame->len = 0;
+    xxh64Init(&frame->hash, 0);
+
+    if (xmlTextReaderIsEmptyElement(reader)) elStatsEnd(depth);
+}
+
+/**
+ *  feed a text node at @depth into the element containing it
+ */
+static void
+elStatsText(xmlTextReaderPtr reader, int depth)
+{
+    const xmlChar *value = xmlTextReaderConstValue(reader), *p;
+    elStatFrame *frame;
+
+    if (depth < 1 || depth > statFramesSize || !value) return;
+    frame = &statFrames[depth - 1];
+    if (!frame->stat) return;
+
+    for (p = value; *p; p++)
+        if ((*p & 0xC0) != 0x80) frame->len++;
+    xxh64Update(&frame->hash, value, p - value);
+    frame->has_text = 1;
+}
+
+/**
+ *  compile elOps.pattern, with the prefixes declared on @root, for
+ *  matching while streaming
+ */
+static xmlPatternPtr
+elPattern(xmlNodePtr root)
+{
+    xmlNsPtr *list = xmlGetNsList(root->doc, root);
+    const xmlChar **namespaces = NULL;
+    xmlPatternPtr comp;
+    int n = 0, i;
+
+    if (list)
+    {
+        while (list[n]) n++;
+        namespaces = xmlMalloc((2 * n + 2) * sizeof(xmlChar *));
+        for (i = 0; i < n; i++)
+        {
+            namespaces[2 * i] = list[i]->href;
+            namespaces[2 * i + 1] = list[i]->prefix;
+        }
+        namespaces[2 * n] = namespaces[2 * n + 1] = NULL;
+    }
+    comp = xmlPatterncompile(BAD_CAST elOps.pattern, NULL, XML_PATTERN_XPATH,
+        namespaces);
+    xmlFree(namespaces);
+    xmlFree(list);
+    if (!comp || !xmlPatternStreamable(comp))
+    {
+        fprintf(stderr, "invalid pattern '%s'\n", elOps.pattern);
+        exit(EXIT_BAD_ARGS);
+    }
+    return comp;
+}
+
+/**
+ *  read file and print element paths, or collect them into @paths;
+ *  *@reader is reused if set, so that names keep their dictionary
+ */
+int
+parse_xml_file(elPaths *paths, xmlTextReaderPtr *readerp, const char *filename)
+{
+    xmlTextReaderPtr reader = *readerp;
+    xmlPatternPtr pattern = NULL;
+    xmlStreamCtxtPtr stream = NULL;
+    int ret, skip = 0;
+    int matched = -1;           /* depth of the matching element we are in */
+    int maxDepth = -1;          /* below it nothing can match, if >= 0 */
+
+    if (reader? xmlReaderNewFile(reader, filename, NULL, 0) != 0 :
+        !(reader = *readerp = xmlReaderForFile(filename, NULL, 0)))
+    {
+        fprintf(stderr, "couldn't read file '%s'\n", filename);
+        return EXIT_BAD_FILE;
+    }
+
+    for (;;)
+    {
+        int depth, id;
+        const xmlChar *name, *path;
+        xmlReaderTypes type;
+
+        ret = skip? xmlTextReaderNext(reader) : xmlTextReaderRead(reader);
+        skip = 0;
         if (ret <= 0) break;
         type = xmlTextReaderNodeType(reader);
         depth = xmlTextReaderDepth(reader);
         name = xmlTextReaderConstName(reader);
 
-        if (type != XML_READER_TYPE_ELEMENT)
+        /* with -p, only let matching subtrees through */
+        if (elOps.pattern && (matched < 0 || depth <= matched))
+        {
+            if (type == XML_READER_TYPE_END_ELEMENT)
+            {
+                xmlStreamPop(stream);
+                if (depth != matched) continue;
+                matched = -1;
+            }
+            else if (type != XML_READER_TYPE_ELEMENT)
+                continue;
+            else
+            {
+                int empty = xmlTextReaderIsEmptyElement(reader);
+
+                if (!pattern)
+                {
+                    pattern = elPattern(xmlTextReaderCurrentNode(reader));
+                    stream = xmlPatternGetStreamCtxt(pattern);
+                    xmlStreamPush(stream, NULL, NULL);  /* the document */
+                    maxDepth = xmlPatternMaxDepth(pattern);
+                }
+                if (xmlStreamPush(stream, xmlTextReaderConstLocalName(reader),
+                        xmlTextReaderConstNamespaceUri(reader)) == 1)
+                {
+                    if (empty) xmlStreamPop(stream);
+                    else matched = depth;
+                }
+                else
+                {
+                    if (empty || (maxDepth >= 0 && depth + 1 >= maxDepth))
+                    {
+                        /* nothing further down can match */
+                        xmlStreamPop(stream);
+                        skip = !empty;
+                    }
+                    else elPathPush(paths, name, depth);
+                    continue;
+                }
+            }
+        }
+
+        if (inferModel)
+        {
+            if (type == XML_READER_TYPE_ELEMENT)
+                inferElement(inferModel, reader, depth);
+            else if (type == XML_READER_TYPE_END_ELEMENT)
+                inferEndElement(inferModel, depth);
+            else if (type == XML_READER_TYPE_TEXT ||
+                     type == XML_READER_TYPE_CDATA ||
+                     type == XML_READER_TYPE_WHITESPACE ||
+                     type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE)
+                inferText(inferModel, xmlTextReaderConstValue(reader), depth);
             continue;
+        }
 
-        while (curXPath && depth <= prev_depth)
+        if (elOps.stats)
         {
-            xmlChar *slash = BAD_CAST strrchr((char*) curXPath, '/');
-            if (slash) *slash = '\0';
-            prev_depth--;
+            if (type == XML_READER_TYPE_END_ELEMENT)
+                elStatsEnd(depth);
+            else if (type == XML_READER_TYPE_TEXT ||
+                     type == XML_READER_TYPE_CDATA)
+                elStatsText(reader, depth);
         }
-        prev_depth = depth;
 
-        if (depth > 0) curXPath = xmlStrcat(curXPath, BAD_CAST "/");
-        curXPath = xmlStrcat(curXPath, name);
+        if (type != XML_READER_TYPE_ELEMENT)
+            continue;
+
+        /* nothing below the limit is reported */
+        if (elOps.check_depth && depth >= elOps.check_depth)
+            continue;
+
+        id = elPathPush(paths, name, depth);
 
         if (elOps.show_attr)
         {
             int have_attr;
 
-            fprintf(stdout, "%s\n", curXPath);
+            path = elPath(paths, id);
+            fprintf(stdout, "%s\n", path);
             for (have_attr = xmlTextReaderMoveToFirstAttribute(reader);
                  have_attr;
                  have_attr = xmlTextReaderMoveToNextAttribute(reader))
             {
                 const xmlChar *aname = xmlTextReaderConstName(reader);
-                fprintf(stdout, "%s/@%s\n", curXPath, aname);
+                fprintf(stdout, "%s/@%s\n", path, aname);
             }
         }
         else if (elOps.show_attr_and_val)
         {
-            fprintf(stdout, "%s", curXPath);
+            fprintf(stdout, "%s", elPath(paths, id));
             if (xmlTextReaderHasAttributes(reader))
             {
                 int have_attr, first = 1;
@@ -153,15 +588,19 @@ parse_xml_file(const char *filename)
         }
         else if (elOps.sort_uniq)
         {
-            if ((elOps.check_depth == 0) || (elOps.check_depth != 0 && depth < elOps.check_depth))
-            {
-                xmlHashAddEntry(uniq, curXPath, (void*) 1);
-            }
+            /* the trie holds the distinct paths, printed at the end */
+            paths->nodes[id].seen = 1;
         }
-        else fprintf(stdout, "%s\n", curXPath);
+        else if (elOps.stats)
+        {
+            elStatsElement(reader, &paths->nodes[id], depth);
+        }
+        else fprintf(stdout, "%s\n", elPath(paths, id));
 
     }
 
+    if (stream) xmlFreeStreamCtxt(stream);
+    if (pattern) xmlFreePattern(pattern);
     return ret == -1? EXIT_LIB_ERROR : ret;
 }
 
@@ -175,6 +614,8 @@ elInitOptions(elOptions *ops)
     ops->show_attr_and_val = 0;
     ops->sort_uniq = 0;
     ops->check_depth = 0; 
+    ops->stats = 0;
+    ops->pattern = NULL;
 }
 
 typedef struct {
@@ -204,6 +645,218 @@ compare_string_ptr(const void *p1, const void *p2)
     return xmlStrcmp(*str1, *str2);
 }
 
+/**
+ * a compare function for qsort
+ * takes pointers to 2 elPathNode* and compares their paths
+ */
+static int
+compare_path_node_ptr(const void *p1, const void *p2)
+{
+    const elPathNode *const *node1 = p1, *const *node2 = p2;
+    return xmlStrcmp((*node1)->path, (*node2)->path);
+}
+
+/**
+ *  print one line of the --stats table
+ */
+static void
+print_stat_line(const xmlChar *path, const xmlChar *attr, int depth,
+    unsigned long count, unsigned long total, const elValueStat *vs)
+{
+    printf("%s%s%s\t%lu\t%d\t%.1f%%", path, attr? "/@" : "",
+        attr? (const char*) attr : "", count, depth,
+        total? 100.0 * vs->count / total : 0.0);
+    if (vs->count)
+        printf("\t%lu\t%lu\t%lu\n", elValueDistinct(vs),
+            vs->min_len, vs->max_len);
+    else
+        printf("\t0\t-\t-\n");
+}
+
+/**
+ *  print the statistics collected for each path, sorted by path
+ */
+static void
+print_stats(elPaths *paths)
+{
+    int i, j, n = 0;
+    elPathNode **nodes = xmlMalloc(sizeof(elPathNode*) * (paths->count + 1));
+
+    for (i = 0; i < paths->count; i++)
+    {
+        if (!paths->nodes[i].stat) continue;
+        elPath(paths, i);
+        nodes[n++] = &paths->nodes[i];
+    }
+    qsort(nodes, n, sizeof(elPathNode*), compare_path_node_ptr);
+
+    printf("path\tcount\tdepth\tfill\tdistinct\tminlen\tmaxlen\n");
+    for (i = 0; i < n; i++)
+    {
+        elPathNode *node = nodes[i];
+        elStat *stat = node->stat;
+        ArrayDest attrs;
+
+        print_stat_line(node->path, NULL, node->depth,
+            stat->count, stat->count, &stat->text);
+        if (!stat->attrs) continue;
+
+        attrs.array = xmlMalloc(sizeof(xmlChar*) * xmlHashSize(stat->attrs));
+        attrs.offset = 0;
+        xmlHashScan(stat->attrs, (xmlHashScanner) hash_key_put, &attrs);
+        qsort(attrs.array, attrs.offset, sizeof(xmlChar*), compare_string_ptr);
+        for (j = 0; j < attrs.offset; j++)
+        {
+            elValueStat *vs = xmlHashLookup(stat->attrs, attrs.array[j]);
+            print_stat_line(node->path, attrs.array[j], node->depth + 1,
+                vs->count, stat->count, vs);
+        }
+        xmlFree(attrs.array);
+    }
+    xmlFree(nodes);
+}
+
+/*
+ *  el -u and -d<n> over many files: each worker reads files off a shared
+ *  list into a trie of its own, and the path sets are merged by a single
+ *  sort at the end
+ */
+
+typedef struct _elUnionQueue {
+    char **files;
+    int nfiles;
+    int next;                   /* next file to read */
+    int *results;               /* per file */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    void *errorCtxt;            /* main thread's error handlers */
+    xmlStructuredErrorFunc errorFunc;
+    void *genericCtxt;
+    xmlGenericErrorFunc genericFunc;
+} elUnionQueue;
+
+typedef struct _elUnionWorker {
+    elUnionQueue *queue;
+    elPaths paths;
+} elUnionWorker;
+
+static void *
+elUnionWork(void *arg)
+{
+    elUnionWorker *worker = arg;
+    elUnionQueue *queue = worker->queue;
+    xmlTextReaderPtr reader = NULL;
+
+    xmlSetStructuredErrorFunc(queue->errorCtxt, queue->errorFunc);
+    xmlSetGenericErrorFunc(queue->genericCtxt, queue->genericFunc);
+    for (;;)
+    {
+        int i;
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&queue->lock);
+#endif
+        i = queue->next;
+        if (i < queue->nfiles) queue->next++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&queue->lock);
+#endif
+        if (i >= queue->nfiles) break;
+        queue->results[i] =
+            parse_xml_file(&worker->paths, &reader, queue->files[i]);
+    }
+    if (reader) xmlFreeTextReader(reader);
+    return NULL;
+}
+
+/**
+ *  print the sorted union of the element paths of @nfiles @files, read
+ *  by @jobs threads
+ */
+static int
+elUnion(char **files, int nfiles, int jobs)
+{
+    static char *stdinFile[] = { "-" };
+    elUnionQueue queue;
+    elUnionWorker *workers;
+    ArrayDest lines;
+    int i, id, total = 0, errorno = 0;
+#ifdef HAVE_PTHREAD
+    pthread_t *threads;
+    int *started;
+#endif
+
+    if (nfiles == 0)
+    {
+        files = stdinFile;
+        nfiles = 1;
+    }
+#ifndef HAVE_PTHREAD
+    jobs = 1;
+#endif
+    if (jobs > nfiles) jobs = nfiles;
+
+    queue.files = files;
+    queue.nfiles = nfiles;
+    queue.next = 0;
+    queue.results = xmlMalloc(nfiles * sizeof(int));
+    queue.errorCtxt = xmlStructuredErrorContext;
+    queue.errorFunc = xmlStructuredError;
+    queue.genericCtxt = xmlGenericErrorContext;
+    queue.genericFunc = xmlGenericError;
+    workers = xmlMalloc(jobs * sizeof(elUnionWorker));
+    memset(workers, 0, jobs * sizeof(elUnionWorker));
+    for (i = 0; i < jobs; i++) workers[i].queue = &queue;
+
+#ifdef HAVE_PTHREAD
+    /* the main thread is worker 0 */
+    xmlInitParser();
+    pthread_mutex_init(&queue.lock, NULL);
+    threads = xmlMalloc(jobs * sizeof(pthread_t));
+    started = xmlMalloc(jobs * sizeof(int));
+    for (i = 1; i < jobs; i++)
+        started[i] = !pthread_create(&threads[i], NULL, elUnionWork,
+            &workers[i]);
+    elUnionWork(&workers[0]);
+    for (i = 1; i < jobs; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&queue.lock);
+    xmlFree(threads);
+    xmlFree(started);
+#else
+    elUnionWork(&workers[0]);
+#endif
+
+    for (i = 0; i < nfiles && !errorno; i++)
+        errorno = queue.results[i];
+
+    for (i = 0; i < jobs; i++)
+        total += workers[i].paths.count;
+    lines.array = xmlMalloc(sizeof(xmlChar*) * (total + 1));
+    lines.offset = 0;
+    for (i = 0; i < jobs; i++)
+        for (id = 0; id < workers[i].paths.count; id++)
+            if (workers[i].paths.nodes[id].seen)
+                lines.array[lines.offset++] =
+                    (xmlChar*) elPath(&workers[i].paths, id);
+
+    qsort(lines.array, lines.offset, sizeof(xmlChar*), compare_string_ptr);
+
+    for (i = 0; i < lines.offset; i++)
+    {
+        if (i == 0 || xmlStrcmp(lines.array[i], lines.array[i - 1]))
+            printf("%s\n", lines.array[i]);
+    }
+
+    xmlFree(lines.array);
+    for (i = 0; i < jobs; i++)
+        elPathsFree(&workers[i].paths);
+    xmlFree(workers);
+    xmlFree(queue.results);
+    return errorno;
+}
+
 /**
  *  This is the main function for 'el' option
  */
@@ -212,13 +865,26 @@ elMain(int argc, char **argv)
 {
     int errorno = 0;
     char* inp_file = "-";
+    elPaths paths;
+    xmlTextReaderPtr reader = NULL;
 
     if (argc <= 1) elUsage(argc, argv, EXIT_BAD_ARGS);
 
     elInitOptions(&elOps);
+    memset(&paths, 0, sizeof(paths));
+
+    /* -p <xpath> comes first, the rest is parsed as without it */
+    if (argc > 3 && !strcmp(argv[2], "-p"))
+    {
+        elOps.pattern = argv[3];
+        argv[3] = argv[1];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
 
     if (argc == 2)
-        errorno = parse_xml_file("-");  
+        errorno = parse_xml_file(&paths, &reader, "-");
     else
     {
         if (!strcmp(argv[2], "--help") || !strcmp(argv[2], "-h") ||
@@ -230,57 +896,75 @@ elMain(int argc, char **argv)
         {
             elOps.show_attr = 1;
             if (argc >= 4) inp_file = argv[3];
-            errorno = parse_xml_file(inp_file);
+            errorno = parse_xml_file(&paths, &reader, inp_file);
         }
         else if (!strcmp(argv[2], "-v"))
         {
             elOps.show_attr_and_val = 1;
             if (argc >= 4) inp_file = argv[3];
-            errorno = parse_xml_file(inp_file);
+            errorno = parse_xml_file(&paths, &reader, inp_file);
         }
-        else if (!strcmp(argv[2], "-u"))
+        else if (!strcmp(argv[2], "-u") || !strncmp(argv[2], "-d", 2))
         {
+            int i = 3, jobs = 1;
+
+            if (argv[2][1] == 'd')
+                elOps.check_depth = atoi(argv[2]+2);
+            /* printf("Checking depth (%d)\n", elOps.check_depth); */
             elOps.sort_uniq = 1;
-            if (argc >= 4) inp_file = argv[3];
-            uniq = xmlHashCreate(0);
-            errorno = parse_xml_file(inp_file);
+            if (i < argc &&
+                (!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j")))
+            {
+                if (++i >= argc) elUsage(argc, argv, EXIT_BAD_ARGS);
+                jobs = atoi(argv[i++]);
+                if (jobs < 1) elUsage(argc, argv, EXIT_BAD_ARGS);
+            }
+            errorno = elUnion(argv + i, argc - i, jobs);
         }
-        else if (!strncmp(argv[2], "-d", 2)) 
-        { 
-            elOps.check_depth = atoi(argv[2]+2); 
-            /* printf("Checking depth (%d)\n", elOps.check_depth); */ 
-            elOps.sort_uniq = 1; 
+        else if (!strcmp(argv[2], "--stats"))
+        {
+            elOps.stats = 1;
             if (argc >= 4) inp_file = argv[3];
-            uniq = xmlHashCreate(0);
-            errorno = parse_xml_file(inp_file); 
+            errorno = parse_xml_file(&paths, &reader, inp_file);
+            if (reader) print_stats(&paths);
+            xmlFree(statFrames);
+        }
+        else if (!strcmp(argv[2], "--infer"))
+        {
+            int i, xsd;
+            static char *stdinFile[] = { "-" };
+            char **files = argv + 4;
+            int nfiles = argc - 4;
+
+            if (argc < 4 || (strcmp(argv[3], "xsd") && strcmp(argv[3], "dtd")))
+                elUsage(argc, argv, EXIT_BAD_ARGS);
+            xsd = !strcmp(argv[3], "xsd");
+            if (nfiles == 0)
+            {
+                files = stdinFile;
+                nfiles = 1;
+            }
+
+            inferModel = inferNew();
+            for (i = 0; i < nfiles; i++)
+            {
+                int ret = parse_xml_file(&paths, &reader, files[i]);
+                if (!errorno) errorno = ret;
+            }
+            if (xsd) inferWriteXsd(inferModel, stdout);
+            else inferWriteDtd(inferModel, stdout);
+            inferFree(inferModel);
+            inferModel = NULL;
         }
         else if (argv[2][0] != '-')
         {
-            errorno = parse_xml_file(argv[2]);
+            errorno = parse_xml_file(&paths, &reader, argv[2]);
         }
         else
             elUsage(argc, argv, EXIT_BAD_ARGS);
     }
 
-    if (uniq)
-    {
-        int i;
-        ArrayDest lines;
-        lines.array = xmlMalloc(sizeof(xmlChar*) * xmlHashSize(uniq));
-        lines.offset = 0;
-        xmlHashScan(uniq, hash_key_put, &lines);
-
-        qsort(lines.array, lines.offset, sizeof(xmlChar*), compare_string_ptr);
-
-        for (i = 0; i < lines.offset; i++)
-        {
-            printf("%s\n", lines.array[i]);
-        }
-
-        xmlFree(lines.array);
-        xmlHashFree(uniq, NULL);
-    }
-
+    if (reader) xmlFreeTextReader(reader);
+    elPathsFree(&paths);
     return errorno;
 }
-
@@ -42,8 +42,22 @@ THE SOFTWARE.
 #include <libxml/xpointer.h>
 #include <libxml/parserInternals.h>
 #include <libxml/uri.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "xmlstar.h"
+#include "filemap.h"
+#include "minify.h"
+
+#if !HAVE_LSTAT
+# define lstat stat
+#endif
 
 /*
  *  TODO:  1. Attribute formatting options (as every attribute on a new line)
@@ -57,6 +71,10 @@ typedef struct _foOptions {
     int omit_decl;            /* omit xml declaration */
     int recovery;             /* try to recover what is parsable */
     int dropdtd;              /* remove the DOCTYPE of the input docs */
+    int minify;               /* strip whitespace without parsing */
+    int inplace;              /* replace each file with its output */
+    int check;                /* compare each file with its output */
+    int jobs;                 /* number of threads */
     int options;              /* global parsing flags */ 
 #ifdef LIBXML_HTML_ENABLED
     int html;                 /* inputs are in HTML format */
@@ -95,6 +113,10 @@ foInitOptions(foOptionsPtr ops)
     ops->omit_decl = 0;
     ops->recovery = 0;
     ops->dropdtd = 0;
+    ops->minify = 0;
+    ops->inplace = 0;
+    ops->check = 0;
+    ops->jobs = 1;
     ops->options = XML_PARSE_NONET;
 #ifdef LIBXML_HTML_ENABLED
     ops->html = 0;
@@ -103,18 +125,11 @@ foInitOptions(foOptionsPtr ops)
 }
 
 /**
- *  Initialize LibXML
+ *  Set the parser and writer defaults, which libxml2 keeps per thread
  */
-void
-foInitLibXml(foOptionsPtr ops)
+static void
+foInitThread(foOptionsPtr ops)
 {
-    /*
-     * Initialize library memory
-     */
-    xmlInitMemory();
-
-    LIBXML_TEST_VERSION
-
     /*
      * Store line numbers in the document tree
      */
@@ -138,16 +153,35 @@ foInitLibXml(foOptionsPtr ops)
         }
         else if (ops->indent_spaces > 0)
         {
-            spaces = xmlMalloc(ops->indent_spaces + 1);
             xmlTreeIndentString = spaces;
-            memset(spaces, ' ', ops->indent_spaces);
-            spaces[ops->indent_spaces] = '\0';
         }
     }
     else
         xmlIndentTreeOutput = 0;
 }
 
+/**
+ *  Initialize LibXML
+ */
+void
+foInitLibXml(foOptionsPtr ops)
+{
+    /*
+     * Initialize library memory
+     */
+    xmlInitMemory();
+
+    LIBXML_TEST_VERSION
+
+    if (ops->indent && !ops->indent_tab && ops->indent_spaces > 0)
+    {
+        spaces = xmlMalloc(ops->indent_spaces + 1);
+        memset(spaces, ' ', ops->indent_spaces);
+        spaces[ops->indent_spaces] = '\0';
+    }
+    foInitThread(ops);
+}
+
 /**
  *  Parse global command line options
  */
@@ -185,6 +219,29 @@ foParseOptions(foOptionsPtr ops, int argc, char **argv)
             ops->dropdtd = 1;
             i++;
         }
+        else if (!strcmp(argv[i], "--minify") || !strcmp(argv[i], "-m"))
+        {
+            ops->minify = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--inplace") || !strcmp(argv[i], "-L"))
+        {
+            ops->inplace = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--check"))
+        {
+            ops->check = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j"))
+        {
+            i++;
+            if (i >= argc) foUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->jobs = atoi(argv[i]);
+            if (ops->jobs < 1) foUsage(argc, argv, EXIT_BAD_ARGS);
+            i++;
+        }
         else if (!strcmp(argv[i], "--recover") || !strcmp(argv[i], "-R"))
         {
             ops->recovery = 1;
@@ -240,7 +297,6 @@ foParseOptions(foOptionsPtr ops, int argc, char **argv)
         }
         else if (!strcmp(argv[i], "-"))
         {
-            i++;
             break;
         }
         else if (argv[i][0] == '-')
@@ -249,48 +305,807 @@ foParseOptions(foOptionsPtr ops, int argc, char **argv)
         }
         else
         {
-            i++;
             break;
         }
     }
 
-    return i-1;
+    return i;
 }
 
+/*
+ *  Where the output of a file goes: a stream of its own, memory while
+ *  files before it are still being formatted, or nowhere, when it is
+ *  only compared with the file
+ */
+/*
+ *  A streamed document writes as it is parsed; the first FO_HOLD bytes
+ *  of its output are held back, so that one found not to be well-formed
+ *  by then writes nothing, as it does when it is loaded first
+ */
+#define FO_HOLD (1024 * 1024)
+
+typedef struct _foSink {
+    FILE *file;               /* write here if not NULL */
+    int holding;              /* gather up to FO_HOLD bytes first */
+    char *data;               /* or gather here */
+    size_t len;
+    size_t size;
+    const char *expect;       /* or compare with this */
+    size_t expectSize;
+    size_t pos;               /* bytes that matched */
+    xmlParserCtxtPtr parser;  /* stopped once they differ */
+    int failed;               /* a write failed or differed */
+} foSink;
+
 /**
- *  'process' xml document(s)
+ *  write out what @sink holds, and the rest as it comes
  */
-int
-foProcess(foOptionsPtr ops, int start, int argc, char **argv)
+static int
+foSinkRelease(foSink *sink)
 {
-    int ret = 0;
-    xmlDocPtr doc = NULL;
-    char *fileName = "-";
+    if (sink->len > 0 && !sink->failed &&
+        fwrite(sink->data, 1, sink->len, sink->file) != sink->len)
+        sink->failed = 1;
+    xmlFree(sink->data);
+    sink->data = NULL;
+    sink->len = sink->size = 0;
+    sink->holding = 0;
+    return sink->failed? -1 : 0;
+}
+
+static int
+foSinkWrite(void *context, const char *buffer, int len)
+{
+    foSink *sink = context;
 
-    if ((start > 1) && (start < argc) && (argv[start][0] != '-') &&
-        strcmp(argv[start-1], "--indent-spaces") &&
-        strcmp(argv[start-1], "-s"))
+    if (sink->expect != NULL)
     {
-        fileName = argv[start];   
+        size_t n = sink->expectSize - sink->pos, i;
+
+        /* not an error for libxml2, the writer just stops */
+        if (sink->failed) return len;
+        if (n > (size_t) len) n = len;
+        if (n == (size_t) len &&
+            memcmp(buffer, sink->expect + sink->pos, n) == 0)
+        {
+            sink->pos += n;
+            return len;
+        }
+        for (i = 0; i < n && buffer[i] == sink->expect[sink->pos + i]; i++)
+            ;
+        sink->pos += i;
+        sink->failed = 1;
+        /* the rest of the document can't change the answer */
+        if (sink->parser != NULL) xmlStopParser(sink->parser);
+        return len;
     }
+    if (sink->failed) return -1;
+    if (sink->holding && sink->len + len > FO_HOLD &&
+        foSinkRelease(sink) != 0)
+        return -1;
+    if (sink->file != NULL && !sink->holding)
+    {
+        if (fwrite(buffer, 1, len, sink->file) != (size_t) len)
+        {
+            sink->failed = 1;
+            return -1;
+        }
+        return len;
+    }
+    if (sink->len + len > sink->size)
+    {
+        sink->size = 2 * sink->size + len;
+        sink->data = xmlRealloc(sink->data, sink->size);
+    }
+    memcpy(sink->data + sink->len, buffer, len);
+    sink->len += len;
+    return len;
+}
+
+static xmlOutputBufferPtr
+foSinkOutput(foSink *sink, xmlCharEncodingHandlerPtr handler)
+{
+    return xmlOutputBufferCreateIO(foSinkWrite, NULL, sink, handler);
+}
+
 /*
-    if (ops->recovery)
+ *  Streaming formatter.  The tree builder keeps running, so whitespace,
+ *  entities and namespaces come out exactly as with xmlReadFile(), but
+ *  only the open elements, their first and last child and at most
+ *  FO_LOOKAHEAD bytes of pending content stay in memory.  Whatever is
+ *  written goes through xmlNodeDumpOutput() one finished child at a time
+ *  and is then freed.  Like xmlsave, an element is indented unless it has
+ *  text; one whose text is still missing after FO_LOOKAHEAD bytes is
+ *  taken as indented.
+ */
+
+#define FO_CHUNK     (64 * 1024)        /* write smaller elements whole */
+#define FO_LOOKAHEAD (1024 * 1024)      /* wait this long for mixed content */
+#define FO_MAX_INDENT 60                /* MAX_INDENT of xmlsave.c */
+
+typedef struct _foFrame {
+    xmlNodePtr node;          /* open element */
+    unsigned long start;      /* input offset of its content */
+    int fmt;                  /* its content is indented: -1 if unknown */
+    int hasText;              /* it has a text, CDATA or entity child */
+    int started;              /* its start tag is written */
+    xmlNodePtr done;          /* last child written */
+} foFrame;
+
+typedef struct _foStream {
+    foOptionsPtr ops;
+    xmlParserCtxtPtr ctxt;    /* reused from file to file */
+    xmlSAXHandler sax;        /* the tree builder */
+    foFrame *frames;
+    int framesSize;
+    foSink *sink;
+    int nframes;
+    xmlNodePtr docDone;       /* last top level node written */
+    int holdAll;              /* XHTML: leave the root to xmlsave */
+    int ended;
+    int opened;
+    xmlOutputBufferPtr out;
+    const char *encoding;     /* passed to xmlNodeDumpOutput() */
+    int escape;               /* no output encoding: use char refs */
+} foStream;
+
+static unsigned long
+foOffset(xmlParserCtxtPtr ctxt)
+{
+    xmlParserInputPtr in = ctxt->inputTab[0];
+    return in->consumed + (in->cur - in->base);
+}
+
+/**
+ *  text escaping of xmlsave.c when no encoding is known: markup and
+ *  every non ASCII character become references
+ */
+static xmlChar *
+foEscape(const xmlChar *in)
+{
+    const xmlChar *p;
+    xmlChar *ret, *out;
+    int len = 0, pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        out = ret = (pass == 0)? NULL : xmlMalloc(len + 1);
+        for (p = in; *p; ) {
+            char ref[16];
+            const char *s = ref;
+            unsigned int c = *p++;
+
+            if (c == '<') s = "&lt;";
+            else if (c == '>') s = "&gt;";
+            else if (c == '&') s = "&amp;";
+            else if (c >= 0x20 && c < 0x80) s = NULL;
+            else if (c == '\n' || c == '\t') s = NULL;
+            else {
+                if (c >= 0xF0) {
+                    c = (c & 0x07) << 18 | (p[0] & 0x3F) << 12 |
+                        (p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+                    p += 3;
+                } else if (c >= 0xE0) {
+                    c = (c & 0x0F) << 12 | (p[0] & 0x3F) << 6 | (p[1] & 0x3F);
+                    p += 2;
+                } else if (c >= 0x80) {
+                    c = (c & 0x1F) << 6 | (p[0] & 0x3F);
+                    p += 1;
+                }
+                sprintf(ref, "&#x%X;", c);
+            }
+            if (s == NULL) {
+                if (out) *out++ = p[-1];
+                len += (pass == 0);
+            } else {
+                int n = strlen(s);
+                if (out) { memcpy(out, s, n); out += n; }
+                if (pass == 0) len += n;
+            }
+        }
+    }
+    *out = '\0';
+    return ret;
+}
+
+/**
+ *  turn the text nodes under @node into escaped ones xmlsave.c
+ *  copies as they are
+ */
+static void
+foEscapeTexts(xmlNodePtr node)
+{
+    xmlNodePtr cur = node;
+
+    for (;;) {
+        if (cur->type == XML_TEXT_NODE && cur->name != xmlStringTextNoenc &&
+            cur->content != NULL) {
+            xmlChar *text = foEscape(cur->content);
+            xmlNodeSetContent(cur, NULL);
+            cur->content = text;
+            cur->name = xmlStringTextNoenc;
+        }
+        if (cur->type == XML_ELEMENT_NODE && cur->children != NULL) {
+            cur = cur->children;
+            continue;
+        }
+        while (cur != node && cur->next == NULL) cur = cur->parent;
+        if (cur == node) break;
+        cur = cur->next;
+    }
+}
+
+static void
+foDump(foStream *st, xmlOutputBufferPtr out, xmlNodePtr node,
+    int level, int format)
+{
+    xmlDtdPtr dtd = st->ops->dropdtd? xmlGetIntSubset(node->doc) : NULL;
+    const xmlChar *sysId = NULL, *pubId = NULL;
+    const xmlChar *docEncoding = node->doc->encoding;
+
+    /* the DOM path has no DTD left to take for XHTML */
+    if (dtd != NULL) {
+        sysId = dtd->SystemID;
+        pubId = dtd->ExternalID;
+        dtd->SystemID = dtd->ExternalID = NULL;
+    }
+    /* xmlSaveFormatFileEnc() escapes attributes for the output encoding */
+    if (!st->ops->omit_decl && st->encoding != NULL)
+        node->doc->encoding = BAD_CAST st->encoding;
+    if (st->escape) foEscapeTexts(node);
+    xmlNodeDumpOutput(out, node->doc, node, level, format, st->encoding);
+    node->doc->encoding = docEncoding;
+    if (dtd != NULL) {
+        dtd->SystemID = sysId;
+        dtd->ExternalID = pubId;
+    }
+}
+
+/**
+ *  set up the output like xmlSaveFormatFileEnc() would, declaration
+ *  included
+ */
+static int
+foOpen(foStream *st)
+{
+    xmlDocPtr doc = st->ctxt->myDoc;
+    const xmlChar *enc = BAD_CAST encoding;
+    xmlCharEncodingHandlerPtr handler = NULL;
+
+    if (!st->opened) {
+        st->opened = 1;
+        if (st->ops->omit_decl) {
+            st->out = foSinkOutput(st->sink, NULL);
+            st->encoding = encoding;
+            return st->out != NULL;
+        }
+
+        /* what xmlSAX2EndDocument() will have set */
+        if (enc == NULL) enc = doc->encoding;
+        if (enc == NULL) enc = st->ctxt->encoding;
+        if (enc == NULL) enc = st->ctxt->inputTab[0]->encoding;
+        if (enc != NULL) {
+            handler = xmlFindCharEncodingHandler((const char *) enc);
+            if (handler == NULL) return 0;
+        }
+        st->out = foSinkOutput(st->sink, handler);
+        if (st->out == NULL) return 0;
+        st->encoding = (const char *) enc;
+        st->escape = (enc == NULL);
+
+        xmlOutputBufferWriteString(st->out, "<?xml version=\"");
+        xmlOutputBufferWriteString(st->out,
+            doc->version? (const char *) doc->version : "1.0");
+        xmlOutputBufferWriteString(st->out, "\"");
+        if (enc != NULL) {
+            xmlOutputBufferWriteString(st->out, " encoding=\"");
+            xmlOutputBufferWriteString(st->out, (const char *) enc);
+            xmlOutputBufferWriteString(st->out, "\"");
+        }
+        if (doc->standalone == 0)
+            xmlOutputBufferWriteString(st->out, " standalone=\"no\"");
+        else if (doc->standalone == 1)
+            xmlOutputBufferWriteString(st->out, " standalone=\"yes\"");
+        xmlOutputBufferWriteString(st->out, "?>\n");
+    }
+    return st->out != NULL;
+}
+
+static void
+foIndent(foStream *st, int level)
+{
+    int size = xmlStrlen(BAD_CAST xmlTreeIndentString);
+
+    if (!xmlIndentTreeOutput || size == 0) return;
+    if (level > FO_MAX_INDENT / size) level = FO_MAX_INDENT / size;
+    while (level-- > 0)
+        xmlOutputBufferWrite(st->out, size, xmlTreeIndentString);
+}
+
+/**
+ *  write a finished top level node
+ */
+static void
+foWriteTop(foStream *st, xmlNodePtr node)
+{
+    if (node->type == XML_DTD_NODE && st->ops->dropdtd) return;
+    foDump(st, st->out, node, 0, 1);
+    xmlOutputBufferWriteString(st->out, "\n");
+}
+
+/**
+ *  write a finished child of an element whose start tag is out
+ */
+static void
+foWriteNode(foStream *st, xmlNodePtr node, int level, int fmt)
+{
+    if (fmt == 1 && (node->type == XML_ELEMENT_NODE ||
+        node->type == XML_PI_NODE || node->type == XML_COMMENT_NODE))
+        foIndent(st, level);
+    foDump(st, st->out, node, level, fmt);
+    if (fmt == 1) xmlOutputBufferWriteString(st->out, "\n");
+}
+
+/**
+ *  free a written child, keeping the first and the last one for the
+ *  parser's blank detection
+ */
+static void
+foRelease(foFrame *f, xmlNodePtr node)
+{
+    xmlNodePtr first = f->node->children;
+
+    if (f->done != NULL && f->done != first) {
+        xmlUnlinkNode(f->done);
+        xmlFreeNode(f->done);
+    }
+    if (node != first && node != f->node->last) {
+        f->done = node->prev;
+        xmlUnlinkNode(node);
+        xmlFreeNode(node);
+        return;
+    }
+    f->done = node;
+    if (node->type == XML_ELEMENT_NODE && node->children != NULL) {
+        xmlFreeNodeList(node->children);
+        node->children = node->last = NULL;
+    }
+}
+
+/**
+ *  write the finished children of @f, all of them if it is closed
+ */
+static void
+foWriteChildren(foStream *st, foFrame *f, int level, xmlNodePtr open,
+    int closed)
+{
+    xmlNodePtr cur;
+
+    while ((cur = f->done? f->done->next : f->node->children) != NULL) {
+        if (!closed && cur->next == NULL && (cur == open ||
+            cur->type == XML_TEXT_NODE ||
+            cur->type == XML_CDATA_SECTION_NODE))
+            break;
+        foWriteNode(st, cur, level, f->fmt);
+        foRelease(f, cur);
+    }
+}
+
+static void
+foStartTag(foStream *st, foFrame *f, int level, int pfmt)
+{
+    xmlOutputBufferPtr tag = xmlAllocOutputBuffer(NULL);
+    xmlNodePtr children = f->node->children, last = f->node->last;
+
+    /* xmlsave writes <a .../> for an empty element: keep all but "/>" */
+    f->node->children = f->node->last = NULL;
+    foDump(st, tag, f->node, 0, 0);
+    f->node->children = children;
+    f->node->last = last;
+
+    if (pfmt == 1 && level > 0) foIndent(st, level);
+    xmlOutputBufferWrite(st->out, xmlOutputBufferGetSize(tag) - 2,
+        (const char *) xmlOutputBufferGetContent(tag));
+    xmlOutputBufferWriteString(st->out, f->fmt == 1? ">\n" : ">");
+    xmlOutputBufferClose(tag);
+    f->started = 1;
+}
+
+static void
+foEndTag(foStream *st, foFrame *f, int level)
+{
+    xmlNodePtr node = f->node;
+
+    if (f->fmt == 1) foIndent(st, level);
+    xmlOutputBufferWriteString(st->out, "</");
+    if (node->ns != NULL && node->ns->prefix != NULL) {
+        xmlOutputBufferWriteString(st->out, (const char *) node->ns->prefix);
+        xmlOutputBufferWriteString(st->out, ":");
+    }
+    xmlOutputBufferWriteString(st->out, (const char *) node->name);
+    xmlOutputBufferWriteString(st->out, ">");
+}
+
+/**
+ *  write everything that is decided; small elements are left to be
+ *  written whole when they end
+ */
+static void
+foFlush(foStream *st)
+{
+    xmlDocPtr doc = st->ctxt->myDoc;
+    xmlNodePtr cur;
+    unsigned long pos;
+    int k, pfmt = 1;
+
+    /* nothing more for a broken document, what is held is dropped */
+    if (!st->ctxt->wellFormed) return;
+    /* the output is of no use any more */
+    if (st->sink->failed) {
+        xmlStopParser(st->ctxt);
+        return;
+    }
+
+    if (st->ended) {
+        if (!foOpen(st)) return;
+        while ((cur = st->docDone? st->docDone->next : doc->children)) {
+            foWriteTop(st, cur);
+            st->docDone = cur;
+        }
+        return;
+    }
+
+    pos = foOffset(st->ctxt);
+    for (k = 0; k < st->nframes; k++) {
+        foFrame *f = &st->frames[k];
+
+        if (!f->started) {
+            if (st->holdAll || pos - f->start < FO_CHUNK ||
+                f->node->children == NULL)
+                return;
+            if (f->fmt < 0) {
+                if (pfmt == 0 || f->hasText)
+                    f->fmt = 0;
+                else if (pos - f->start > FO_LOOKAHEAD)
+                    f->fmt = 1;
+                else
+                    return;
+            }
+            if (!foOpen(st)) return;
+            if (k == 0) {
+                while ((cur = st->docDone? st->docDone->next :
+                        doc->children) != f->node) {
+                    foWriteTop(st, cur);
+                    st->docDone = cur;
+                }
+            }
+            foStartTag(st, f, k, pfmt);
+        }
+        foWriteChildren(st, f, k + 1,
+            (k + 1 < st->nframes)? st->frames[k + 1].node : NULL, 0);
+        if (k + 1 < st->nframes &&
+            (f->done? f->done->next : f->node->children) !=
+            st->frames[k + 1].node)
+            return;
+        pfmt = f->fmt;
+    }
+}
+
+static void
+foStartElementNs(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+    const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+    int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    foStream *st = ctxt->_private;
+    foFrame *f;
+
+    st->sax.startElementNs(ctx, localname, prefix, URI, nb_namespaces,
+        namespaces, nb_attributes, nb_defaulted, attributes);
+    if (ctxt != st->ctxt || ctxt->node == NULL) return;
+
+    if (st->nframes == st->framesSize) {
+        st->framesSize = st->framesSize? 2 * st->framesSize : 32;
+        st->frames = xmlRealloc(st->frames,
+            st->framesSize * sizeof(foFrame));
+    }
+    f = &st->frames[st->nframes++];
+    f->node = ctxt->node;
+    f->start = foOffset(ctxt);
+    f->fmt = (st->nframes > 1 && st->frames[st->nframes - 2].fmt == 0)?
+        0 : -1;
+    f->hasText = 0;
+    f->started = 0;
+    f->done = NULL;
+
+    if (st->nframes == 1 && !st->ops->dropdtd) {
+        xmlDtdPtr dtd = xmlGetIntSubset(ctxt->myDoc);
+        if (dtd != NULL && xmlIsXHTML(dtd->SystemID, dtd->ExternalID) > 0)
+            st->holdAll = 1;
+    }
+    foFlush(st);
+}
+
+static void
+foEndElementNs(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+    const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    foStream *st = ctxt->_private;
+    foFrame *f;
+    int k;
+
+    st->sax.endElementNs(ctx, localname, prefix, URI);
+    if (ctxt != st->ctxt || st->nframes == 0) return;
+
+    k = --st->nframes;
+    f = &st->frames[k];
+    if (f->started) {
+        foWriteChildren(st, f, k + 1, NULL, 1);
+        foEndTag(st, f, k);
+        if (k == 0) {
+            xmlOutputBufferWriteString(st->out, "\n");
+            st->docDone = f->node;
+        } else {
+            foFrame *parent = &st->frames[k - 1];
+            if (parent->fmt == 1)
+                xmlOutputBufferWriteString(st->out, "\n");
+            foRelease(parent, f->node);
+        }
+    }
+    foFlush(st);
+}
+
+/**
+ *  a text, CDATA section or entity reference went into the current
+ *  element
+ */
+static void
+foAddText(xmlParserCtxtPtr ctxt)
+{
+    foStream *st = ctxt->_private;
+
+    if (ctxt != st->ctxt || st->nframes == 0) return;
+    st->frames[st->nframes - 1].hasText = 1;
+    foFlush(st);
+}
+
+static void
+foCharacters(void *ctx, const xmlChar *ch, int len)
+{
+    foStream *st = ((xmlParserCtxtPtr) ctx)->_private;
+
+    st->sax.characters(ctx, ch, len);
+    foAddText(ctx);
+}
+
+static void
+foCdataBlock(void *ctx, const xmlChar *value, int len)
+{
+    foStream *st = ((xmlParserCtxtPtr) ctx)->_private;
+
+    st->sax.cdataBlock(ctx, value, len);
+    foAddText(ctx);
+}
+
+static void
+foReference(void *ctx, const xmlChar *name)
+{
+    foStream *st = ((xmlParserCtxtPtr) ctx)->_private;
+
+    st->sax.reference(ctx, name);
+    foAddText(ctx);
+}
+
+static void
+foComment(void *ctx, const xmlChar *value)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    foStream *st = ctxt->_private;
+
+    st->sax.comment(ctx, value);
+    if (ctxt == st->ctxt && !ctxt->inSubset) foFlush(st);
+}
+
+static void
+foProcessingInstruction(void *ctx, const xmlChar *target,
+    const xmlChar *data)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    foStream *st = ctxt->_private;
+
+    st->sax.processingInstruction(ctx, target, data);
+    if (ctxt == st->ctxt && !ctxt->inSubset) foFlush(st);
+}
+
+static void
+foEndDocument(void *ctx)
+{
+    xmlParserCtxtPtr ctxt = ctx;
+    foStream *st = ctxt->_private;
+
+    st->sax.endDocument(ctx);
+    if (ctxt != st->ctxt) return;
+    st->ended = 1;
+    foFlush(st);
+}
+
+/**
+ *  create the parser of @st, with the formatter between it and the tree
+ *  builder
+ */
+static int
+foStreamInit(foStream *st)
+{
+    xmlSAXHandlerPtr sax;
+
+    st->ctxt = xmlNewParserCtxt();
+    if (st->ctxt == NULL) return -1;
+    xmlCtxtUseOptions(st->ctxt, st->ops->options);
+
+    sax = st->ctxt->sax;
+    st->sax = *sax;
+    sax->startElementNs = foStartElementNs;
+    sax->endElementNs = foEndElementNs;
+    /* blank detection depends on whether these two are the same */
+    if (sax->ignorableWhitespace == sax->characters)
+        sax->ignorableWhitespace = foCharacters;
+    sax->characters = foCharacters;
+    if (sax->cdataBlock) sax->cdataBlock = foCdataBlock;
+    sax->reference = foReference;
+    sax->comment = foComment;
+    sax->processingInstruction = foProcessingInstruction;
+    sax->endDocument = foEndDocument;
+    return 0;
+}
+
+/**
+ *  format @fileName into @sink without keeping it in memory
+ */
+static int
+foStreamFile(foStream *st, const char *fileName, foSink *sink)
+{
+    xmlParserCtxtPtr ctxt;
+    xmlParserInputPtr input;
+    int ret = 0;
+
+    if (st->ctxt == NULL)
     {
-        doc = xmlRecoverFile(fileName);
+        if (foStreamInit(st) != 0) return 2;
     }
-    else    
-*/
-    if (ops->quiet)
-        suppressErrors();
+    else
+    {
+        xmlCtxtReset(st->ctxt);
+        xmlCtxtUseOptions(st->ctxt, st->ops->options);
+    }
+    ctxt = st->ctxt;
+    ctxt->_private = st;
+    st->sink = sink;
+    sink->parser = ctxt;
+    if (sink->file != NULL) sink->holding = 1;
+    st->nframes = 0;
+    st->docDone = NULL;
+    st->holdAll = st->ended = st->opened = st->escape = 0;
+    st->out = NULL;
+    st->encoding = NULL;
+
+    input = xmlLoadExternalEntity(fileName, NULL, ctxt);
+    if (input == NULL) return 2;
+    inputPush(ctxt, input);
+    if (ctxt->directory == NULL)
+        ctxt->directory = xmlParserGetDirectory(fileName);
+
+    xmlParseDocument(ctxt);
+
+    if (!ctxt->wellFormed) ret = 2;
+    if (st->out != NULL) xmlOutputBufferClose(st->out);
+    sink->parser = NULL;
+    if (ret != 0) sink->len = 0;        /* drop what is held or gathered */
+    if (sink->holding) foSinkRelease(sink);
+    xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+    return ret;
+}
+
+/**
+ *  strip whitespace from @fileName into @sink without parsing it
+ */
+static int
+foMinify(foOptionsPtr ops, const char *fileName, foSink *sink)
+{
+    FileMap map;
+    const char *error;
+    size_t offset;
+    int flags = 0, ret;
+
+    if (fileMapOpen(&map, fileName) != 0)
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "couldn't read file '%s'\n", fileName);
+        return 2;
+    }
+    if (ops->omit_decl) flags |= MINIFY_OMIT_DECL;
+    if (ops->dropdtd) flags |= MINIFY_DROP_DTD;
+    if (ops->options & XML_PARSE_NOCDATA) flags |= MINIFY_NOCDATA;
+
+    ret = minify(map.data, map.size, foSinkWrite, sink, flags, &error,
+        &offset);
+    if (ret != 0)
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "%s:%lu: %s\n", fileName,
+                (unsigned long) offset, error);
+        ret = 2;
+    }
+    else if (map.size > 0)
+    {
+        foSinkWrite(sink, "\n", 1);
+    }
+    fileMapClose(&map);
+    return ret;
+}
+
+/*
+ *  fo over many files: workers take the files off a shared list, each
+ *  with parsers of its own that are reset rather than recreated for
+ *  every file.  Output for stdout is gathered in memory and written in
+ *  the order of the files; with -L every file is written to a temporary
+ *  file next to it, which then replaces it.
+ */
+
+typedef struct _foQueue {
+    foOptionsPtr ops;
+    char **files;
+    int nfiles;
+    int next;                 /* next file to format */
+    int *results;             /* per file, -1 until formatted */
+    foSink *sinks;            /* per file */
+    int written;              /* files whose output is out */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    void *errorCtxt;          /* main thread's error handlers */
+    xmlStructuredErrorFunc errorFunc;
+    void *genericCtxt;
+    xmlGenericErrorFunc genericFunc;
+} foQueue;
+
+typedef struct _foWorker {
+    foQueue *queue;
+    foStream st;              /* the streaming parser */
+    xmlParserCtxtPtr dom;     /* the -R or -H parser */
+} foWorker;
+
+/**
+ *  format @fileName into @sink
+ */
+static int
+foFormat(foWorker *w, const char *fileName, foSink *sink)
+{
+    foOptionsPtr ops = w->queue->ops;
+    xmlDocPtr doc = NULL;
+
+    if (ops->minify)
+        return foMinify(ops, fileName, sink);
 
 #ifdef LIBXML_HTML_ENABLED
     if (ops->html)
     {
-        doc = htmlReadFile(fileName, NULL, ops->options);
+        if (w->dom == NULL) w->dom = htmlNewParserCtxt();
+        if (w->dom == NULL) return 2;
+        doc = htmlCtxtReadFile(w->dom, fileName, NULL, ops->options);
     }
     else
 #endif
-        doc = xmlReadFile(fileName, NULL, ops->options);
+    if (ops->recovery)
+    {
+        if (w->dom == NULL) w->dom = xmlNewParserCtxt();
+        if (w->dom == NULL) return 2;
+        doc = xmlCtxtReadFile(w->dom, fileName, NULL, ops->options);
+    }
+    else
+    {
+        return foStreamFile(&w->st, fileName, sink);
+    }
 
     if (doc == NULL)
     {
@@ -313,21 +1128,20 @@ foProcess(foOptionsPtr ops, int start, int argc, char **argv)
  
     if (!ops->omit_decl)
     {
-        if (encoding != NULL)
-        {
-            xmlSaveFormatFileEnc("-", doc, encoding, 1);
-        }
-        else
-        {
-            xmlSaveFormatFile("-", doc, 1);
-        }
+        /* what xmlSaveFormatFileEnc() does, into the sink */
+        const char *enc = encoding? encoding : (const char *) doc->encoding;
+        xmlCharEncodingHandlerPtr handler = NULL;
+
+        if (enc != NULL) handler = xmlFindCharEncodingHandler(enc);
+        if (enc == NULL || handler != NULL)
+            xmlSaveFormatFileTo(foSinkOutput(sink, handler), doc, enc, 1);
     }
     else
     {
         int format = 1;
         xmlOutputBufferPtr buf = NULL;
         xmlCharEncodingHandlerPtr handler = NULL;
-        buf = xmlOutputBufferCreateFile(stdout, handler);
+        buf = foSinkOutput(sink, handler);
 
         if (doc->children != NULL)
         {
@@ -339,10 +1153,262 @@ foProcess(foOptionsPtr ops, int start, int argc, char **argv)
                 child = child->next;
             }
         }
-        ret = xmlOutputBufferClose(buf);
+        xmlOutputBufferClose(buf);
     }
     
     xmlFreeDoc(doc);
+    return 0;
+}
+
+/**
+ *  format @fileName into a temporary file beside it, and put that in its
+ *  place if all went well
+ */
+static int
+foInplace(foWorker *w, const char *fileName)
+{
+    foOptionsPtr ops = w->queue->ops;
+    foSink sink;
+    struct stat info;
+    char *tmp;
+    int ret;
+
+    /* the output is renamed over the file: that would put a new file in
+       place of a symbolic link, and leave the file it points to as is */
+    if (lstat(fileName, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "'%s' is not a regular file, left as is\n",
+                fileName);
+        return EXIT_BAD_FILE;
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    tmp = xmlMalloc(strlen(fileName) + 8);
+    sprintf(tmp, "%s.XXXXXX", fileName);
+#ifdef HAVE_MKSTEMP
+    {
+        int fd = mkstemp(tmp);
+
+        if (fd >= 0)
+        {
+            /* keep the permissions, owner and group of the original */
+            fchmod(fd, info.st_mode & 07777);
+            if (fchown(fd, info.st_uid, info.st_gid) != 0)
+            {
+                close(fd);
+                remove(tmp);
+                if (!ops->quiet)
+                    fprintf(stderr, "can't keep the owner of '%s'\n",
+                        fileName);
+                xmlFree(tmp);
+                return EXIT_BAD_FILE;
+            }
+            sink.file = fdopen(fd, "wb");
+            if (sink.file == NULL) close(fd);
+        }
+    }
+#else
+    sprintf(tmp, "%s.tmp", fileName);
+    sink.file = fopen(tmp, "wb");
+#endif
+    if (sink.file == NULL)
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "can't write '%s'\n", tmp);
+        xmlFree(tmp);
+        return EXIT_BAD_FILE;
+    }
+
+    ret = foFormat(w, fileName, &sink);
+    if (fclose(sink.file) != 0) sink.failed = 1;
+    if (ret == 0 && (sink.failed || rename(tmp, fileName) != 0))
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "can't replace '%s'\n", fileName);
+        ret = EXIT_BAD_FILE;
+    }
+    if (ret != 0) remove(tmp);
+    xmlFree(tmp);
+    return ret;
+}
+
+/**
+ *  format @fileName only to compare the output with the file; says on
+ *  @out where they first differ and returns 1 if they do
+ */
+static int
+foCheck(foWorker *w, const char *fileName, foSink *out)
+{
+    foOptionsPtr ops = w->queue->ops;
+    foSink sink;
+    FileMap map;
+    int ret;
+
+    if (fileMapOpen(&map, fileName) != 0)
+    {
+        if (!ops->quiet)
+            fprintf(stderr, "couldn't read file '%s'\n", fileName);
+        return 2;
+    }
+    memset(&sink, 0, sizeof(sink));
+    sink.expect = map.data;
+    sink.expectSize = map.size;
+
+    ret = foFormat(w, fileName, &sink);
+    if (ret == 0 && (sink.failed || sink.pos != map.size))
+    {
+        char where[64];
+
+        sprintf(where, ":%lu: not formatted\n", (unsigned long) sink.pos);
+        foSinkWrite(out, fileName, strlen(fileName));
+        foSinkWrite(out, where, strlen(where));
+        ret = 1;
+    }
+    fileMapClose(&map);
+    return ret;
+}
+
+/**
+ *  write out the gathered output of the files whose turn it is
+ */
+static void
+foWriteOut(foQueue *queue)
+{
+    while (queue->written < queue->nfiles &&
+        queue->results[queue->written] >= 0)
+    {
+        foSink *sink = &queue->sinks[queue->written++];
+
+        if (sink->len > 0) fwrite(sink->data, 1, sink->len, stdout);
+        xmlFree(sink->data);
+        sink->data = NULL;
+    }
+}
+
+static void *
+foWork(void *arg)
+{
+    foWorker *w = arg;
+    foQueue *queue = w->queue;
+
+    xmlSetStructuredErrorFunc(queue->errorCtxt, queue->errorFunc);
+    xmlSetGenericErrorFunc(queue->genericCtxt, queue->genericFunc);
+    foInitThread(queue->ops);
+    for (;;)
+    {
+        int i, ret;
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&queue->lock);
+#endif
+        i = queue->next;
+        if (i < queue->nfiles) queue->next++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&queue->lock);
+#endif
+        if (i >= queue->nfiles) break;
+        if (queue->ops->inplace)
+            ret = foInplace(w, queue->files[i]);
+        else if (queue->ops->check)
+            ret = foCheck(w, queue->files[i], &queue->sinks[i]);
+        else
+            ret = foFormat(w, queue->files[i], &queue->sinks[i]);
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&queue->lock);
+#endif
+        queue->results[i] = ret;
+        foWriteOut(queue);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&queue->lock);
+#endif
+    }
+    if (w->st.ctxt) xmlFreeParserCtxt(w->st.ctxt);
+    xmlFree(w->st.frames);
+    if (w->dom) xmlFreeParserCtxt(w->dom);
+    return NULL;
+}
+
+/**
+ *  'process' xml document(s): format @nfiles @files in @ops->jobs threads
+ */
+int
+foProcess(foOptionsPtr ops, char **files, int nfiles)
+{
+    static char *stdinFile[] = { "-" };
+    foQueue queue;
+    foWorker *workers;
+    int i, jobs = ops->jobs, ret = 0;
+#ifdef HAVE_PTHREAD
+    pthread_t *threads;
+    int *started;
+#endif
+
+    if (nfiles == 0)
+    {
+        files = stdinFile;
+        nfiles = 1;
+    }
+#ifndef HAVE_PTHREAD
+    jobs = 1;
+#endif
+    if (jobs > nfiles) jobs = nfiles;
+
+    if (ops->quiet)
+        suppressErrors();
+
+    queue.ops = ops;
+    queue.files = files;
+    queue.nfiles = nfiles;
+    queue.next = 0;
+    queue.written = 0;
+    queue.results = xmlMalloc(nfiles * sizeof(int));
+    queue.sinks = xmlMalloc(nfiles * sizeof(foSink));
+    memset(queue.sinks, 0, nfiles * sizeof(foSink));
+    for (i = 0; i < nfiles; i++)
+    {
+        queue.results[i] = -1;
+        /* a single worker is always in turn */
+        if (jobs == 1) queue.sinks[i].file = stdout;
+    }
+    queue.errorCtxt = xmlStructuredErrorContext;
+    queue.errorFunc = xmlStructuredError;
+    queue.genericCtxt = xmlGenericErrorContext;
+    queue.genericFunc = xmlGenericError;
+    workers = xmlMalloc(jobs * sizeof(foWorker));
+    memset(workers, 0, jobs * sizeof(foWorker));
+    for (i = 0; i < jobs; i++)
+    {
+        workers[i].queue = &queue;
+        workers[i].st.ops = ops;
+    }
+
+#ifdef HAVE_PTHREAD
+    /* the main thread is worker 0 */
+    xmlInitParser();
+    pthread_mutex_init(&queue.lock, NULL);
+    threads = xmlMalloc(jobs * sizeof(pthread_t));
+    started = xmlMalloc(jobs * sizeof(int));
+    for (i = 1; i < jobs; i++)
+        started[i] = !pthread_create(&threads[i], NULL, foWork,
+            &workers[i]);
+    foWork(&workers[0]);
+    for (i = 1; i < jobs; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&queue.lock);
+    xmlFree(threads);
+    xmlFree(started);
+#else
+    foWork(&workers[0]);
+#endif
+
+    for (i = 0; i < nfiles && !ret; i++)
+        ret = queue.results[i];
+
+    xmlFree(workers);
+    xmlFree(queue.sinks);
+    xmlFree(queue.results);
     return ret;
 }
 
@@ -373,9 +1439,24 @@ foMain(int argc, char **argv)
     if (argc <=1) foUsage(argc, argv, EXIT_BAD_ARGS);
     foInitOptions(&ops);
     start = foParseOptions(&ops, argc, argv);
-    if (argc-start > 1) foUsage(argc, argv, EXIT_BAD_ARGS);
+    /* -L and --check need files to replace or compare with */
+    if (ops.inplace && ops.check) foUsage(argc, argv, EXIT_BAD_ARGS);
+    if (ops.inplace || ops.check)
+    {
+        int i;
+        if (start == argc) foUsage(argc, argv, EXIT_BAD_ARGS);
+        for (i = start; i < argc; i++)
+            if (!strcmp(argv[i], "-")) foUsage(argc, argv, EXIT_BAD_ARGS);
+    }
+    /* --minify copies bytes, it can't recover, convert or parse HTML */
+    if (ops.minify && (ops.recovery || encoding ||
+#ifdef LIBXML_HTML_ENABLED
+        ops.html ||
+#endif
+        (ops.options & XML_PARSE_NSCLEAN)))
+        foUsage(argc, argv, EXIT_BAD_ARGS);
     foInitLibXml(&ops);
-    ret = foProcess(&ops, start, argc, argv);
+    ret = foProcess(&ops, argv + start, argc - start);
     foCleanup();
     
     return ret;
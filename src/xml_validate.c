@@ -31,9 +31,29 @@ THE SOFTWARE.
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#ifdef _WIN32
+# include <direct.h>
+# define mkdir(dir, mode) _mkdir(dir)
+#endif
 
 #include "xmlstar.h"
 #include "trans.h"
+#include "digest.h"
+#include "filemap.h"
 
 #ifdef LIBXML_SCHEMAS_ENABLED
 #include <libxml/xmlschemas.h>
@@ -45,12 +65,13 @@ THE SOFTWARE.
 #endif
 
 #include <libxml/xmlreader.h>
+#include <libxml/SAX2.h>
+#include <libxml/pattern.h>
 
 /*
  *   TODO: Use cases
  *   1. find malfomed XML documents in a given set of XML files 
  *   2. find XML documents which do not match DTD/XSD in a given set of XML files
- *   3. precompile DTD once
  */
 
 typedef struct _valOptions {
@@ -64,6 +85,13 @@ typedef struct _valOptions {
     int   listGood;           /* >0 list good, <0 list bad */
     int   show_val_res;       /* display file names and valid/invalid message */
     int   nonet;              /* disallow network access */
+    char *cache;              /* Directory remembering valid files */
+    char *schemaMap;          /* Root element to schema table */
+    char *recordPattern;      /* Records to validate in parallel */
+    char *report;             /* File to write report to */
+    int   reportJunit;        /* JUnit XML report, rather than JSON */
+    int   splitParallel;      /* Check parts of a document in parallel */
+    int   jobs;               /* Number of threads */
 } valOptions;
 
 typedef valOptions *valOptionsPtr;
@@ -82,197 +110,2508 @@ valUsage(int argc, char **argv, exit_status status)
     exit(status);
 }
 
-/**
- *  Initialize global command line options
- */
-void
-valInitOptions(valOptionsPtr ops)
+/**
+ *  Initialize global command line options
+ */
+void
+valInitOptions(valOptionsPtr ops)
+{
+    ops->wellFormed = 1;
+    ops->err = 0;
+    ops->stop = 0;
+    ops->embed = 0;
+    ops->dtd = NULL;
+    ops->schema = NULL;
+    ops->relaxng = NULL;
+    ops->nonet = 1;
+    ops->cache = NULL;
+    ops->schemaMap = NULL;
+    ops->recordPattern = NULL;
+    ops->report = NULL;
+    ops->reportJunit = 0;
+    ops->splitParallel = 0;
+#ifdef _SC_NPROCESSORS_ONLN
+    ops->jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    ops->jobs = 1;
+#endif
+
+    if (globalOptions.quiet) {
+        ops->listGood = 0;
+        ops->show_val_res = 0;
+    } else {
+        ops->listGood = -1;
+        ops->show_val_res = 1;
+    }
+}
+
+/**
+ *  Parse global command line options
+ */
+int
+valParseOptions(valOptionsPtr ops, int argc, char **argv)
+{
+    int i;
+
+    i = 2;
+    while(i < argc)
+    {
+        if (!strcmp(argv[i], "--well-formed") || !strcmp(argv[i], "-w"))
+        {
+            ops->wellFormed = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--err") || !strcmp(argv[i], "-e"))
+        {
+            ops->err = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--stop") || !strcmp(argv[i], "-S"))
+        {
+            ops->stop = STOP;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--embed") || !strcmp(argv[i], "-E"))
+        {
+            ops->embed = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--list-good") || !strcmp(argv[i], "-g"))
+        {
+            ops->listGood = 1;
+            ops->show_val_res = 0;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--list-bad") || !strcmp(argv[i], "-b"))
+        {
+            ops->listGood = -1;
+            ops->show_val_res = 0;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-q"))
+        {
+            ops->listGood = 0;
+            ops->show_val_res = 0;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--dtd") || !strcmp(argv[i], "-d"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->dtd = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--xsd") || !strcmp(argv[i], "-s"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->schema = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--relaxng") || !strcmp(argv[i], "-r"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->relaxng = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--schema-map"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->schemaMap = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--record-parallel"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->recordPattern = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--report"))
+        {
+            if (i + 2 >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            if (!strcmp(argv[i+1], "junit"))
+                ops->reportJunit = 1;
+            else if (strcmp(argv[i+1], "json"))
+                valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->report = argv[i+2];
+            i += 3;
+        }
+        else if (!strcmp(argv[i], "--split-parallel"))
+        {
+            ops->splitParallel = 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->jobs = atoi(argv[i]);
+            if (ops->jobs < 1) valUsage(argc, argv, EXIT_BAD_ARGS);
+            i++;
+        }
+        else if (!strcmp(argv[i], "--net"))
+        {
+            ops->nonet = 0;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--cache"))
+        {
+            i++;
+            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
+            ops->cache = argv[i];
+            i++;
+        }
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+        {
+            valUsage(argc, argv, EXIT_SUCCESS);
+        }
+        else if (!strcmp(argv[i], "-"))
+        {
+            i++;
+            break;
+        }
+        else if (argv[i][0] == '-')
+        {
+            valUsage(argc, argv, EXIT_BAD_ARGS);
+        }
+        else
+        {
+            i++;
+            break;
+        }
+    }
+
+    return i-1;
+}
+
+/*
+ *  --report: per file statistics and the first few errors, kept until
+ *  the end since JUnit wants the totals up front
+ */
+
+#define VAL_REPORT_ERRORS 10
+
+typedef struct _valReportError {
+    int domain;
+    int code;
+    int line;
+    int column;
+    xmlChar *message;
+} valReportError;
+
+typedef struct _valReportFile {
+    const char *filename;
+    int failed;
+    int cached;               /* result from --cache */
+    long bytes;
+    double seconds;
+    long elements;
+    int errors;
+    valReportError error[VAL_REPORT_ERRORS];
+} valReportFile;
+
+static valReportFile *valReport = NULL;
+static int valReportNr = 0;
+static int valReportMax = 0;
+/* file being validated, while the report is on */
+static valReportFile *valReportCur = NULL;
+
+static double
+valNow(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ *  structured error handler that notes the error for the report before
+ *  passing it on to reportError()
+ */
+static void
+valReportErrorFunc(void *ptr, xmlErrorPtr error)
+{
+    ErrorInfo *errorInfo = (ErrorInfo *) ptr;
+    valReportFile *rf = valReportCur;
+
+    if (rf && rf->errors < VAL_REPORT_ERRORS)
+    {
+        valReportError *e = &rf->error[rf->errors];
+        xmlTextReaderPtr reader = errorInfo->xmlReader;
+        int len;
+
+        e->domain = error->domain;
+        e->code = error->code;
+        e->line = reader? xmlTextReaderGetParserLineNumber(reader) :
+            error->line;
+        e->column = reader? xmlTextReaderGetParserColumnNumber(reader) :
+            error->int2;
+        e->message = xmlStrdup(BAD_CAST (error->message?
+            error->message : ""));
+        len = xmlStrlen(e->message);
+        if (len && e->message[len-1] == '\n')
+            e->message[len-1] = '\0';
+    }
+    if (rf) rf->errors++;
+    reportError(ptr, error);
+}
+
+static void
+valReportBegin(valOptionsPtr ops, const char *filename)
+{
+    if (!ops->report) return;
+    if (valReportNr == valReportMax)
+    {
+        valReportMax = valReportMax? valReportMax * 2 : 64;
+        valReport = xmlRealloc(valReport, valReportMax * sizeof(valReportFile));
+    }
+    valReportCur = &valReport[valReportNr++];
+    memset(valReportCur, 0, sizeof(valReportFile));
+    valReportCur->filename = filename;
+    valReportCur->seconds = valNow();
+}
+
+/**
+ *  finish report on current file; @consumed is the parser's byte count,
+ *  used when the file has no size (stdin), or negative if nothing was read
+ */
+static void
+valReportEnd(int failed, int cached, long consumed)
+{
+    valReportFile *rf = valReportCur;
+    struct stat st;
+
+    if (!rf) return;
+    rf->seconds = valNow() - rf->seconds;
+    rf->failed = failed;
+    rf->cached = cached;
+    if (strcmp(rf->filename, "-") && stat(rf->filename, &st) == 0 &&
+        S_ISREG(st.st_mode))
+        rf->bytes = st.st_size;
+    else
+        rf->bytes = consumed > 0? consumed : 0;
+    valReportCur = NULL;
+}
+
+/* DTD given with --dtd, parsed once and attached to each document as its
+   external subset while the document is parsed */
+static xmlDtdPtr valDtd = NULL;
+/* external subset of the document itself, put back once it's parsed */
+static xmlDtdPtr valDocExtSubset = NULL;
+/* document holding the external DTDs shared by the documents */
+static xmlDocPtr valDtdCacheDoc = NULL;
+
+/**
+ *  push or pop @node for the content model checks: the DTD declares the
+ *  qualified name, as xmlTextReaderValidatePush() has it
+ */
+static int
+valDtdValidateElement(xmlParserCtxtPtr ctxt, xmlNodePtr node, int push)
+{
+    xmlChar buf[50];
+    const xmlChar *qname = node->name;
+    int ret;
+
+    if (node->ns && node->ns->prefix)
+        qname = xmlBuildQName(node->name, node->ns->prefix, buf, sizeof(buf));
+    if (qname == NULL) return 0;
+    if (push)
+        ret = xmlValidatePushElement(&ctxt->vctxt, ctxt->myDoc, node, qname);
+    else
+        ret = xmlValidatePopElement(&ctxt->vctxt, ctxt->myDoc, node, qname);
+    if (qname != node->name && qname != buf)
+        xmlFree((xmlChar *) qname);
+    return ret;
+}
+
+static void
+valDtdStartElementNs(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI,
+    int nb_namespaces, const xmlChar **namespaces,
+    int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlDocPtr doc = ctxt->myDoc;
+
+    if (ctxt->node == NULL && doc)
+    {
+        /* root element: validity checks start here */
+        if (valDtd && doc->extSubset != valDtd)
+        {
+            valDocExtSubset = doc->extSubset;
+            doc->extSubset = valDtd;
+            if (!doc->intSubset)
+                xmlCreateIntSubset(doc, localname, NULL, NULL);
+        }
+        /* keep IDs by name, elements are freed as soon as they end */
+        ctxt->parseMode = XML_PARSE_READER;
+    }
+
+    xmlSAX2StartElementNs(ctx, localname, prefix, URI,
+        nb_namespaces, namespaces, nb_attributes, nb_defaulted, attributes);
+    if (valReportCur) valReportCur->elements++;
+    if (ctxt->validate && ctxt->node)
+        ctxt->valid &= valDtdValidateElement(ctxt, ctxt->node, 1);
+}
+
+static void
+valDtdEndElementNs(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlNodePtr cur = ctxt->node;
+
+    /* checks the attributes; the content was checked as it was pushed */
+    xmlSAX2EndElementNs(ctx, localname, prefix, URI);
+    if (!cur) return;
+    if (ctxt->validate)
+        ctxt->valid &= valDtdValidateElement(ctxt, cur, 0);
+
+    /* nothing needs the element any more */
+    if (cur->parent && cur->parent->type == XML_ELEMENT_NODE) {
+        xmlUnlinkNode(cur);
+        xmlFreeNode(cur);
+    }
+}
+
+/**
+ *  SAX getEntity handler: the entities of the document's own external
+ *  subset are still declared once @valDtd takes its place
+ */
+static xmlEntityPtr
+valDtdGetEntity(void *ctx, const xmlChar *name)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlDocPtr doc = ctxt->myDoc;
+    xmlEntityPtr ent = xmlSAX2GetEntity(ctx, name);
+
+    if (!ent && doc && valDocExtSubset && doc->extSubset == valDtd)
+    {
+        doc->extSubset = valDocExtSubset;
+        ent = xmlSAX2GetEntity(ctx, name);
+        doc->extSubset = valDtd;
+    }
+    return ent;
+}
+
+static void
+valDtdCharacters(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+
+    if (ctxt->validate && ctxt->node)
+        ctxt->valid &= xmlValidatePushCData(&ctxt->vctxt, ch, len);
+}
+
+static void
+valIgnoreError(void *ctx, xmlErrorPtr error)
+{
+    /* do nothing */
+}
+
+static void
+valDtdEndDocument(void *ctx)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+
+    xmlSAX2EndDocument(ctx);
+
+    /* a malformed document leaves elements open, forget them quietly */
+    if (ctxt->vctxt.vstateNr > 0)
+    {
+        void *error_ctxt = xmlStructuredErrorContext;
+        xmlStructuredErrorFunc error_func = xmlStructuredError;
+
+        xmlSetStructuredErrorFunc(NULL, valIgnoreError);
+        while (ctxt->vctxt.vstateNr > 0)
+            xmlValidatePopElement(&ctxt->vctxt, ctxt->myDoc, NULL, NULL);
+        xmlSetStructuredErrorFunc(error_ctxt, error_func);
+    }
+
+    if (ctxt->myDoc && valDtd && ctxt->myDoc->extSubset == valDtd)
+        ctxt->myDoc->extSubset = valDocExtSubset;
+    valDocExtSubset = NULL;
+
+    /* the DTD outlives the document */
+    if (ctxt->myDoc && ctxt->myDoc->extSubset && valDtdCacheDoc &&
+        ctxt->myDoc->extSubset->doc == valDtdCacheDoc)
+        ctxt->myDoc->extSubset = NULL;
+}
+
+/*
+ *  --cache: an entry named after the content hash of a file and the cache
+ *  key records that the file was valid, along with the hashes of any
+ *  other files (external DTDs, entities) the document pulled in
+ */
+
+#define VAL_CACHE_MAGIC "xmlstarlet-val-cache 1\n"
+
+static xmlExternalEntityLoader valDefaultLoader = NULL;
+/* set while the schemas are parsed: every file loaded goes in the key */
+static xxh64State *valSchemaHash = NULL;
+static int valSchemaUncacheable = 0;
+/* set while a cacheable document is parsed: "dep" lines for its entry */
+static xmlBufferPtr valDeps = NULL;
+static int valDepsUncacheable = 0;
+
+static void
+valHex(char *buf, uint64_t h)
+{
+    sprintf(buf, "%08lx%08lx", (unsigned long) (h >> 16 >> 16),
+        (unsigned long) (h & 0xffffffffUL));
+}
+
+/**
+ *  hash content of local file @url into @h; returns -1 if it can't be read
+ */
+static int
+valHashFile(const char *url, uint64_t *h)
+{
+    FileMap map;
+
+    if (!strncmp(url, "file://localhost/", 17)) url += 16;
+    else if (!strncmp(url, "file:///", 8)) url += 7;
+    if (fileMapOpen(&map, url) != 0) return -1;
+    *h = xxh64(map.data, map.size, 0);
+    fileMapClose(&map);
+    return 0;
+}
+
+static xmlParserInputPtr
+valCacheLoader(const char *URL, const char *ID, xmlParserCtxtPtr ctxt)
+{
+    xmlParserInputPtr input = valDefaultLoader(URL, ID, ctxt);
+    const char *filename;
+    uint64_t h;
+    char hex[17];
+
+    if (!input || (!valSchemaHash && !valDeps)) return input;
+    filename = input->filename? input->filename : URL;
+    if (!filename || valHashFile(filename, &h) != 0)
+    {
+        /* remote or unreadable: can't tell if it changes */
+        if (valSchemaHash) valSchemaUncacheable = 1;
+        else valDepsUncacheable = 1;
+        return input;
+    }
+    if (valSchemaHash)
+    {
+        xxh64Update(valSchemaHash, &h, sizeof(h));
+    }
+    else
+    {
+        valHex(hex, h);
+        xmlBufferCCat(valDeps, "dep ");
+        xmlBufferCCat(valDeps, hex);
+        xmlBufferCCat(valDeps, " ");
+        xmlBufferCCat(valDeps, filename);
+        xmlBufferCCat(valDeps, "\n");
+    }
+    return input;
+}
+
+/**
+ *  start collecting the files parsed as part of the schema(s)
+ */
+static void
+valCacheBeginSchemas(valOptionsPtr ops, xxh64State *state)
+{
+    if (!ops->cache) return;
+    valDefaultLoader = xmlGetExternalEntityLoader();
+    xmlSetExternalEntityLoader(valCacheLoader);
+    xxh64Init(state, 0);
+    valSchemaHash = state;
+}
+
+/**
+ *  compute cache key from the schema files, validation mode and parser
+ *  options; turns caching off if the schemas can't be pinned down
+ */
+static uint64_t
+valCacheEndSchemas(valOptionsPtr ops, int options)
+{
+    char mode[64];
+    xxh64State *state = valSchemaHash;
+
+    if (!ops->cache) return 0;
+    valSchemaHash = NULL;
+    if (valSchemaUncacheable)
+    {
+        if (ops->err)
+            fprintf(stderr, "schema is not a local file, not using cache\n");
+        ops->cache = NULL;
+        return 0;
+    }
+    if (mkdir(ops->cache, 0777) != 0)
+    {
+        struct stat st;
+        if (stat(ops->cache, &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            if (ops->err)
+                fprintf(stderr, "can't use cache directory '%s'\n",
+                    ops->cache);
+            ops->cache = NULL;
+            return 0;
+        }
+    }
+    sprintf(mode, "%s%s%s%s%s %d", ops->dtd? "d" : "",
+        ops->schema? "s" : "", ops->relaxng? "r" : "",
+        ops->schemaMap? "m" : "", ops->embed? "E" : "", options);
+    xxh64Update(state, mode, strlen(mode));
+    return xxh64Final(state);
+}
+
+static char *
+valCacheEntryName(valOptionsPtr ops, uint64_t content, uint64_t key)
+{
+    char *name = xmlMalloc(strlen(ops->cache) + 2 + 33 + 4);
+    char *p;
+
+    sprintf(name, "%s/", ops->cache);
+    p = name + strlen(name);
+    valHex(p, content);
+    p[16] = '-';
+    valHex(p + 17, key);
+    return name;
+}
+
+static void
+valCacheHeader(char *buf, uint64_t content, uint64_t key, size_t size)
+{
+    char hex[17];
+
+    strcpy(buf, VAL_CACHE_MAGIC "file ");
+    valHex(hex, content);
+    sprintf(buf + strlen(buf), "%s %lu\nkey ", hex, (unsigned long) size);
+    valHex(hex, key);
+    sprintf(buf + strlen(buf), "%s\n", hex);
+}
+
+/**
+ *  map @filename into @map for hashing and parsing; returns 0 if the
+ *  file can't take part in caching
+ */
+static int
+valCacheOpen(valOptionsPtr ops, const char *filename, FileMap *map)
+{
+    if (!ops->cache || !strcmp(filename, "-")) return 0;
+    return fileMapOpen(map, filename) == 0;
+}
+
+/**
+ *  returns 1 if @map (content of @filename) is recorded as valid under @key
+ *  and none of the files it depends on changed
+ */
+static int
+valCacheLookup(valOptionsPtr ops, uint64_t key, const FileMap *map,
+    uint64_t *content)
+{
+    char *name;
+    char header[128];
+    FileMap entry;
+    const char *p, *end;
+    size_t len;
+    int found = 0;
+
+    *content = xxh64(map->data, map->size, 0);
+    name = valCacheEntryName(ops, *content, key);
+    if (fileMapOpen(&entry, name) != 0)
+    {
+        xmlFree(name);
+        return 0;
+    }
+    xmlFree(name);
+
+    valCacheHeader(header, *content, key, map->size);
+    len = strlen(header);
+    p = entry.data;
+    end = entry.data + entry.size;
+    if ((size_t) (end - p) < len || memcmp(p, header, len) != 0)
+        goto done;
+    p += len;
+    while (end - p > 21 && !memcmp(p, "dep ", 4) && p[20] == ' ')
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        char *dep;
+        char hex[17];
+        uint64_t h;
+        int same;
+
+        if (!eol) goto done;
+        dep = (char *) xmlStrndup((const xmlChar *) p + 21, eol - p - 21);
+        same = valHashFile(dep, &h) == 0;
+        xmlFree(dep);
+        if (same) {
+            valHex(hex, h);
+            same = !memcmp(hex, p + 4, 16);
+        }
+        if (!same) goto done;
+        p = eol + 1;
+    }
+    found = (end - p == 6 && !memcmp(p, "valid\n", 6));
+
+done:
+    fileMapClose(&entry);
+    return found;
+}
+
+/**
+ *  whether the parser can read @map directly, rather than the file
+ */
+static int
+valCacheParseMapped(const FileMap *map)
+{
+    /* libxml2 only inflates compressed files it opens itself */
+    if (map->size >= 2 && (unsigned char) map->data[0] == 0x1f &&
+        (unsigned char) map->data[1] == 0x8b)
+        return 0;
+    return map->size < INT_MAX;
+}
+
+typedef struct _valMapReader {
+    const FileMap *map;
+    size_t pos;
+} valMapReader;
+
+static int
+valMapRead(void *context, char *buffer, int len)
+{
+    valMapReader *r = context;
+    size_t left = r->map->size - r->pos;
+
+    if ((size_t) len > left) len = left;
+    memcpy(buffer, r->map->data + r->pos, len);
+    r->pos += len;
+    return len;
+}
+
+/**
+ *  record that the file with @content was valid, given the files in
+ *  @deps, replacing any old entry in one step
+ */
+static void
+valCacheStore(valOptionsPtr ops, uint64_t key, const FileMap *map,
+    uint64_t content, xmlBufferPtr deps)
+{
+    char *name, *tmp;
+    char header[128];
+    FILE *f;
+    int ok;
+
+    name = valCacheEntryName(ops, content, key);
+    tmp = xmlMalloc(strlen(name) + 5);
+    sprintf(tmp, "%s.tmp", name);
+    f = fopen(tmp, "wb");
+    if (f)
+    {
+        valCacheHeader(header, content, key, map->size);
+        fputs(header, f);
+        fwrite(xmlBufferContent(deps), 1, xmlBufferLength(deps), f);
+        fputs("valid\n", f);
+        ok = (fclose(f) == 0);
+        if (ok) ok = (rename(tmp, name) == 0);
+        if (!ok) remove(tmp);
+    }
+    else if (ops->err)
+    {
+        fprintf(stderr, "can't write cache entry '%s'\n", tmp);
+    }
+    xmlFree(tmp);
+    xmlFree(name);
+}
+
+/**
+ *  (re)start @reader on @filename, or on its content in @mem if not NULL;
+ *  returns 0 on success
+ */
+static int
+valReaderOpen(xmlTextReaderPtr *reader, const char *filename,
+    const FileMap *mem, int options)
+{
+    if (mem)
+    {
+        if (!*reader)
+            *reader = xmlReaderForMemory(mem->data, mem->size, filename,
+                NULL, options);
+        else
+            return xmlReaderNewMemory(*reader, mem->data, mem->size,
+                filename, NULL, options);
+    }
+    else if (!*reader)
+    {
+        *reader = xmlReaderForFile(filename, NULL, options);
+    }
+    else
+    {
+        return xmlReaderNewFile(*reader, filename, NULL, options);
+    }
+    return *reader? 0 : -1;
+}
+
+/*
+ *  external DTDs of the documents are parsed once, with the first
+ *  document naming them, and then shared by the documents that follow
+ */
+
+typedef struct _valDtdCacheEntry {
+    xmlDtdPtr dtd;            /* NULL if each document parses its own */
+    xmlChar *deps;            /* --cache "dep" lines of the files loaded */
+    int uncacheable;
+} valDtdCacheEntry;
+
+/* by resolved system ID and public ID */
+static xmlHashTablePtr valDtdCache = NULL;
+static int valDtdErrors;
+static xmlStructuredErrorFunc valDtdErrorFunc;
+
+static void
+valDtdCountError(void *ctx, xmlErrorPtr error)
+{
+    valDtdErrors++;
+    if (valDtdErrorFunc) valDtdErrorFunc(ctx, error);
+}
+
+/*
+ *  the parser normalizes the values of non-CDATA attributes by their types
+ *  in ctxt->attsSpecial, which it fills while it parses the declarations;
+ *  that table isn't part of the API, so it's filled for a shared DTD only
+ *  with the libxml2 versions known to use it this way
+ */
+#if LIBXML_VERSION >= 20900 && LIBXML_VERSION < 21300
+#define VAL_ATTS_SPECIAL
+#endif
+
+static int
+valAttsSpecial(void)
+{
+#ifdef VAL_ATTS_SPECIAL
+    int version = atoi(xmlParserVersion);
+
+    return version >= 20900 && version < 21300;
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  a DTD can be shared if the parser keeps nothing from it but the DTD
+ *  itself: default attribute values live in the parser context, and so do
+ *  the types of the others unless valAttsSpecial()
+ */
+static int
+valDtdShareable(xmlDtdPtr dtd)
+{
+    xmlNodePtr cur;
+    xmlAttributePtr attr;
+
+    for (cur = dtd->children; cur; cur = cur->next)
+    {
+        if (cur->type != XML_ATTRIBUTE_DECL) continue;
+        attr = (xmlAttributePtr) cur;
+        if (attr->defaultValue ||
+            (attr->atype != XML_ATTRIBUTE_CDATA && !valAttsSpecial()))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ *  put the types of the non-CDATA attributes declared in @dtd where the
+ *  parser looks for them to normalize attribute values, as it does while
+ *  parsing the declarations
+ */
+static void
+valDtdSpecialAttrs(xmlParserCtxtPtr ctxt, xmlDtdPtr dtd)
+{
+#ifdef VAL_ATTS_SPECIAL
+    xmlNodePtr cur;
+    xmlAttributePtr attr;
+    const xmlChar *name;
+
+    for (cur = dtd->children; cur; cur = cur->next)
+    {
+        if (cur->type != XML_ATTRIBUTE_DECL) continue;
+        attr = (xmlAttributePtr) cur;
+        if (attr->atype == XML_ATTRIBUTE_CDATA) continue;
+        if (!ctxt->attsSpecial)
+            ctxt->attsSpecial = xmlHashCreateDict(10, ctxt->dict);
+        if (!ctxt->attsSpecial) return;
+        name = attr->prefix?
+            xmlDictQLookup(ctxt->dict, attr->prefix, attr->name) :
+            attr->name;
+        /* the first declaration wins: the internal subset's is kept */
+        if (!xmlHashLookup2(ctxt->attsSpecial, attr->elem, name))
+            xmlHashAddEntry2(ctxt->attsSpecial, attr->elem, name,
+                (void *) (ptrdiff_t) attr->atype);
+    }
+#endif
+}
+
+static void
+valDtdCacheFree(void *payload, const xmlChar *name)
+{
+    valDtdCacheEntry *entry = payload;
+
+    xmlFreeDtd(entry->dtd);
+    xmlFree(entry->deps);
+    xmlFree(entry);
+}
+
+/**
+ *  SAX externalSubset handler: attach the DTD parsed for an earlier
+ *  document with the same system and public IDs, or parse it and keep it
+ */
+static void
+valExternalSubset(void *ctx, const xmlChar *name,
+    const xmlChar *ExternalID, const xmlChar *SystemID)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlDocPtr doc = ctxt->myDoc;
+    const xmlChar *base;
+    xmlChar *uri;
+    valDtdCacheEntry *entry;
+    xmlDtdPtr dtd;
+    xmlBufferPtr scratch = NULL;
+    int deps_start, uncacheable;
+
+    /* a standalone document must not need the external declarations;
+     * declarations in the internal subset (parameter entities selecting
+     * conditional sections, or names the external subset then skips)
+     * make the parsed DTD specific to this document */
+    if (!SystemID || !doc || doc->extSubset || !ctxt->wellFormed ||
+        ctxt->standalone == 1 || !(ctxt->validate || ctxt->loadsubset) ||
+        (doc->intSubset && doc->intSubset->children))
+    {
+        xmlSAX2ExternalSubset(ctx, name, ExternalID, SystemID);
+        return;
+    }
+    base = ctxt->input? BAD_CAST ctxt->input->filename : NULL;
+    if (!base) base = BAD_CAST ctxt->directory;
+    uri = xmlBuildURI(SystemID, base);
+    if (!uri)
+    {
+        xmlSAX2ExternalSubset(ctx, name, ExternalID, SystemID);
+        return;
+    }
+
+    if (!valDtdCache) valDtdCache = xmlHashCreate(8);
+    entry = xmlHashLookup2(valDtdCache, uri, ExternalID);
+    if (entry && entry->dtd)
+    {
+        doc->extSubset = entry->dtd;
+        valDtdSpecialAttrs(ctxt, entry->dtd);
+        if (valDeps)
+        {
+            if (entry->uncacheable) valDepsUncacheable = 1;
+            if (entry->deps) xmlBufferCat(valDeps, entry->deps);
+        }
+        xmlFree(uri);
+        return;
+    }
+    if (entry)
+    {
+        xmlSAX2ExternalSubset(ctx, name, ExternalID, SystemID);
+        xmlFree(uri);
+        return;
+    }
+
+    /* with --cache, the files loaded matter to the documents that follow */
+    uncacheable = valDepsUncacheable;
+    if (!valDeps && valDefaultLoader)
+    {
+        scratch = valDeps = xmlBufferCreate();
+        valDepsUncacheable = 0;
+    }
+    deps_start = valDeps? xmlBufferLength(valDeps) : 0;
+    valDtdErrors = 0;
+    valDtdErrorFunc = xmlStructuredError;
+    xmlSetStructuredErrorFunc(xmlStructuredErrorContext, valDtdCountError);
+    xmlSAX2ExternalSubset(ctx, name, ExternalID, SystemID);
+    xmlSetStructuredErrorFunc(xmlStructuredErrorContext, valDtdErrorFunc);
+
+    entry = xmlMalloc(sizeof(valDtdCacheEntry));
+    memset(entry, 0, sizeof(valDtdCacheEntry));
+    dtd = doc->extSubset;
+    /* errors in the DTD must be seen with each document */
+    if (dtd && !valDtdErrors && ctxt->wellFormed && valDtdShareable(dtd) &&
+        (!valDtdCacheDoc || valDtdCacheDoc->dict == ctxt->dict))
+    {
+        if (!valDtdCacheDoc)
+        {
+            valDtdCacheDoc = xmlNewDoc(BAD_CAST "1.0");
+            valDtdCacheDoc->dict = ctxt->dict;
+            xmlDictReference(ctxt->dict);
+        }
+        /* move it to the document that outlives this one */
+        xmlUnlinkNode((xmlNodePtr) dtd);
+        xmlSetTreeDoc((xmlNodePtr) dtd, valDtdCacheDoc);
+        doc->extSubset = dtd;
+        entry->dtd = dtd;
+        if (valDeps)
+        {
+            entry->uncacheable = scratch? valDepsUncacheable :
+                valDepsUncacheable && !uncacheable;
+            entry->deps = xmlStrdup(xmlBufferContent(valDeps) + deps_start);
+        }
+    }
+    if (scratch)
+    {
+        xmlBufferFree(scratch);
+        valDeps = NULL;
+        valDepsUncacheable = uncacheable;
+    }
+    xmlHashAddEntry2(valDtdCache, uri, ExternalID, entry);
+    xmlFree(uri);
+}
+
+/**
+ *  create parser context that validates against @valDtd, or the DTD of
+ *  each document, as it parses, keeping just the open elements in memory;
+ *  it's reused for each document
+ */
+static xmlParserCtxtPtr
+valNewDtdCtxt(void)
+{
+    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+
+    if (!ctxt)
+    {
+        xmlGenericError(xmlGenericErrorContext,
+            "Couldn't allocate validation context\n");
+        exit(-1);
+    }
+    ctxt->sax->startElementNs = valDtdStartElementNs;
+    ctxt->sax->endElementNs = valDtdEndElementNs;
+    ctxt->sax->characters = valDtdCharacters;
+    ctxt->sax->ignorableWhitespace = valDtdCharacters;
+    ctxt->sax->cdataBlock = valDtdCharacters;
+    ctxt->sax->comment = NULL;
+    ctxt->sax->processingInstruction = NULL;
+    ctxt->sax->externalSubset = valExternalSubset;
+    ctxt->sax->endDocument = valDtdEndDocument;
+    ctxt->sax->getEntity = valDtdGetEntity;
+    return ctxt;
+}
+
+/**
+ *  free the shared DTDs, with the parser context they were parsed with
+ */
+static void
+valFreeDtdCtxt(xmlParserCtxtPtr ctxt)
+{
+    xmlHashFree(valDtdCache, valDtdCacheFree);
+    valDtdCache = NULL;
+    xmlFreeDoc(valDtdCacheDoc);
+    valDtdCacheDoc = NULL;
+    /* the parser context leaves the element stack of the validation */
+    xmlFree(ctxt->vctxt.vstateTab);
+    ctxt->vctxt.vstateTab = NULL;
+    xmlFreeParserCtxt(ctxt);
+}
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+
+/*
+ *  --schema-map: each line of the map file names a root element, as
+ *  "{namespace}name" or just "name", and the XSD or Relax-NG (*.rng)
+ *  schema for documents starting with it.  Every schema is compiled once.
+ */
+
+typedef struct _valMapSchema {
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr validCtxt;
+    xmlRelaxNGPtr relaxng;
+} valMapSchema;
+
+/* (local name, namespace) -> schema */
+static xmlHashTablePtr valRoutes = NULL;
+/* schema file name -> schema, for roots sharing a schema */
+static xmlHashTablePtr valMapSchemas = NULL;
+
+static void
+valFreeMapSchema(void *payload, const xmlChar *name)
+{
+    valMapSchema *ms = payload;
+
+    xmlSchemaFreeValidCtxt(ms->validCtxt);
+    xmlSchemaFree(ms->schema);
+    xmlRelaxNGFree(ms->relaxng);
+    xmlFree(ms);
+}
+
+static valMapSchema *
+valCompileMapSchema(const xmlChar *path, ErrorInfo *errorInfo)
+{
+    valMapSchema *ms;
+    size_t len = xmlStrlen(path);
+
+    ms = xmlHashLookup(valMapSchemas, path);
+    if (ms) return ms;
+    ms = xmlMalloc(sizeof(valMapSchema));
+    memset(ms, 0, sizeof(valMapSchema));
+    errorInfo->filename = (const char *) path;
+
+    if (len > 4 && !xmlStrcasecmp(path + len - 4, BAD_CAST ".rng"))
+    {
+        xmlRelaxNGParserCtxtPtr pctxt =
+            xmlRelaxNGNewParserCtxt((const char *) path);
+        if (pctxt)
+        {
+            ms->relaxng = xmlRelaxNGParse(pctxt);
+            xmlRelaxNGFreeParserCtxt(pctxt);
+        }
+    }
+    else
+    {
+        xmlSchemaParserCtxtPtr pctxt =
+            xmlSchemaNewParserCtxt((const char *) path);
+        if (pctxt)
+        {
+            ms->schema = xmlSchemaParse(pctxt);
+            xmlSchemaFreeParserCtxt(pctxt);
+        }
+        if (ms->schema)
+            ms->validCtxt = xmlSchemaNewValidCtxt(ms->schema);
+    }
+    errorInfo->filename = NULL;
+    if (!ms->relaxng && !ms->validCtxt)
+    {
+        fprintf(stderr, "couldn't compile schema '%s'\n", path);
+        valFreeMapSchema(ms, NULL);
+        return NULL;
+    }
+    xmlHashAddEntry(valMapSchemas, path, ms);
+    return ms;
+}
+
+/**
+ *  read the map file and compile the schemas in it; returns 0 on success
+ */
+static int
+valLoadSchemaMap(const char *filename, ErrorInfo *errorInfo)
+{
+    FileMap map;
+    const char *p, *end;
+    int line = 0, ret = 0;
+
+    if (fileMapOpen(&map, filename) != 0)
+    {
+        fprintf(stderr, "couldn't read schema map '%s'\n", filename);
+        return -1;
+    }
+    valRoutes = xmlHashCreate(16);
+    valMapSchemas = xmlHashCreate(16);
+
+    for (p = map.data, end = map.data + map.size; p < end && !ret; )
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *root, *root_end, *path, *path_end, *local;
+        xmlChar *ns = NULL, *name, *rel, *uri;
+        valMapSchema *ms;
+
+        if (!eol) eol = end;
+        line++;
+        root = p;
+        p = eol + 1;
+
+        while (root < eol && IS_BLANK_CH(*root)) root++;
+        if (root == eol || *root == '#') continue;
+        root_end = root;
+        while (root_end < eol && !IS_BLANK_CH(*root_end)) root_end++;
+        path = root_end;
+        while (path < eol && IS_BLANK_CH(*path)) path++;
+        path_end = eol;
+        while (path_end > path && IS_BLANK_CH(path_end[-1])) path_end--;
+        local = root;
+        if (*root == '{')
+        {
+            local = memchr(root, '}', root_end - root);
+            if (local) ns = xmlStrndup(BAD_CAST root + 1, local++ - root - 1);
+        }
+        if (!local || local == root_end || path == path_end)
+        {
+            fprintf(stderr, "%s:%d: expected <root-element> <schema-file>\n",
+                filename, line);
+            xmlFree(ns);
+            ret = -1;
+            break;
+        }
+
+        /* schema file names are relative to the map */
+        rel = xmlStrndup(BAD_CAST path, path_end - path);
+        uri = xmlBuildURI(rel, BAD_CAST filename);
+        xmlFree(rel);
+        ms = uri? valCompileMapSchema(uri, errorInfo) : NULL;
+        xmlFree(uri);
+
+        name = xmlStrndup(BAD_CAST local, root_end - local);
+        if (!ms)
+            ret = -1;
+        else if (xmlHashAddEntry2(valRoutes, name, ns, ms) != 0)
+        {
+            fprintf(stderr, "%s:%d: root element %s mapped twice\n",
+                filename, line, name);
+            ret = -1;
+        }
+        xmlFree(name);
+        xmlFree(ns);
+    }
+    fileMapClose(&map);
+    return ret;
+}
+
+static void
+valFreeSchemaMap(void)
+{
+    xmlHashFree(valRoutes, NULL);
+    xmlHashFree(valMapSchemas, valFreeMapSchema);
+    valRoutes = NULL;
+    valMapSchemas = NULL;
+}
+
+/**
+ *  find schema for document @filename from its root element, read with
+ *  @peek; returns 1 when found, 0 if no schema is mapped to the root and
+ *  -1 if there is no root to be found (the validating parse will tell why)
+ */
+static int
+valRoute(xmlTextReaderPtr *peek, const char *filename, const FileMap *mem,
+    valMapSchema **ms, int verbose)
+{
+    void *error_ctxt = xmlStructuredErrorContext;
+    xmlStructuredErrorFunc error_func = xmlStructuredError;
+    int ret = -1;
+
+    /* errors are left for the validating parse to report */
+    xmlSetStructuredErrorFunc(NULL, valIgnoreError);
+    if (valReaderOpen(peek, filename, mem, XML_PARSE_NONET) == 0)
+    {
+        while (xmlTextReaderRead(*peek) == 1)
+        {
+            const xmlChar *ns;
+
+            if (xmlTextReaderNodeType(*peek) != XML_READER_TYPE_ELEMENT)
+                continue;
+            ns = xmlTextReaderConstNamespaceUri(*peek);
+            *ms = xmlHashLookup2(valRoutes,
+                xmlTextReaderConstLocalName(*peek), ns);
+            ret = *ms != NULL;
+            if (!ret && verbose)
+                fprintf(stderr, "%s: no schema for root element %s%s%s%s\n",
+                    filename, ns? "{" : "", ns? (const char *) ns : "",
+                    ns? "}" : "", xmlTextReaderConstLocalName(*peek));
+            break;
+        }
+        xmlTextReaderClose(*peek);
+    }
+    xmlSetStructuredErrorFunc(error_ctxt, error_func);
+    return ret;
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+ *  --record-parallel: the records of a document, the elements matching a
+ *  pattern, are copied out as the reader goes and validated each on its
+ *  own by worker threads, against the global declaration of the record
+ *  element; what is left, the envelope, is validated with empty records
+ *  in their place.  The copies don't keep where in the file their elements
+ *  end, so a document found invalid is validated again as a whole to
+ *  report its errors.
+ */
+
+/* records handed to a worker at once */
+#define VAL_RECORD_BATCH 64
+
+typedef struct _valRecord {
+    xmlDocPtr doc;            /* records, as children of the root */
+    int count;
+    struct _valRecord *next;
+} valRecord;
+
+typedef struct _valRecordQueue {
+    xmlSchemaPtr schema;
+    valRecord *head;
+    valRecord *tail;
+    int queued;
+    int max;
+    int done;                 /* no more records coming */
+    long elements;
+    int errors;
+    int whole;                /* validate the document as a whole */
+    pthread_mutex_t lock;
+    pthread_cond_t more;      /* a record was queued, or that's all */
+    pthread_cond_t room;      /* a record was taken */
+} valRecordQueue;
+
+/* mark of the empty records left in the envelope */
+static char valShell[] = "record";
+
+static void
+valRecordErrorFunc(void *ctx, xmlErrorPtr error)
+{
+    valRecordQueue *queue = ctx;
+
+    pthread_mutex_lock(&queue->lock);
+    if (error->code == XML_SCHEMAV_CVC_ELT_1)
+        queue->whole = 1;
+    queue->errors++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void
+valEnvelopeErrorFunc(void *ctx, xmlErrorPtr error)
+{
+    xmlNodePtr node = error->node;
+
+    /* the empty records are bound to be invalid */
+    if (node && node->type == XML_ATTRIBUTE_NODE) node = node->parent;
+    if (node && node->_private == valShell) return;
+    valRecordErrorFunc(ctx, error);
+}
+
+static long
+valCountElements(xmlNodePtr node)
+{
+    long n = 0;
+
+    for (; node; node = node->next)
+        if (node->type == XML_ELEMENT_NODE)
+            n += 1 + valCountElements(node->children);
+    return n;
+}
+
+/**
+ *  validate the records of @rec with @vctxt, and free it
+ */
+static void
+valRecordValidate(valRecordQueue *queue, xmlSchemaValidCtxtPtr vctxt,
+    valRecord *rec)
+{
+    xmlNodePtr cur;
+    long n;
+
+    xmlSchemaSetValidStructuredErrors(vctxt, valRecordErrorFunc, queue);
+    for (cur = rec->doc->children->children; cur; cur = cur->next)
+        xmlSchemaValidateOneElement(vctxt, cur);
+    n = valCountElements(rec->doc->children->children);
+    xmlFreeDoc(rec->doc);
+    xmlFree(rec);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->elements += n;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void *
+valRecordWorker(void *arg)
+{
+    valRecordQueue *queue = arg;
+    xmlSchemaValidCtxtPtr vctxt = xmlSchemaNewValidCtxt(queue->schema);
+    valRecord *rec;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;)
+    {
+        while (!queue->head && !queue->done)
+            pthread_cond_wait(&queue->more, &queue->lock);
+        rec = queue->head;
+        if (!rec) break;
+        queue->head = rec->next;
+        if (!queue->head) queue->tail = NULL;
+        queue->queued--;
+        pthread_cond_signal(&queue->room);
+        pthread_mutex_unlock(&queue->lock);
+
+        valRecordValidate(queue, vctxt, rec);
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    xmlSchemaFreeValidCtxt(vctxt);
+    return NULL;
+}
+
+static void
+valRecordPush(valRecordQueue *queue, valRecord *rec)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->queued >= queue->max)
+        pthread_cond_wait(&queue->room, &queue->lock);
+    if (queue->tail)
+        queue->tail->next = rec;
+    else
+        queue->head = rec;
+    queue->tail = rec;
+    queue->queued++;
+    pthread_cond_signal(&queue->more);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ *  compile @pattern, with the prefixes declared on @root
+ */
+static xmlPatternPtr
+valRecordPattern(const char *pattern, xmlNodePtr root)
+{
+    xmlNsPtr *list = xmlGetNsList(root->doc, root);
+    const xmlChar **namespaces = NULL;
+    xmlPatternPtr comp;
+    int n = 0, i;
+
+    if (list)
+    {
+        while (list[n]) n++;
+        namespaces = xmlMalloc((2 * n + 2) * sizeof(xmlChar *));
+        for (i = 0; i < n; i++)
+        {
+            namespaces[2 * i] = list[i]->href;
+            namespaces[2 * i + 1] = list[i]->prefix;
+        }
+        namespaces[2 * n] = namespaces[2 * n + 1] = NULL;
+    }
+    comp = xmlPatterncompile(BAD_CAST pattern, NULL, XML_PATTERN_XPATH,
+        namespaces);
+    xmlFree(namespaces);
+    xmlFree(list);
+    return comp;
+}
+
+static valRecord *
+valNewRecords(void)
+{
+    valRecord *rec = xmlMalloc(sizeof(valRecord));
+
+    rec->doc = xmlNewDoc(BAD_CAST "1.0");
+    xmlDocSetRootElement(rec->doc,
+        xmlNewDocNode(rec->doc, NULL, BAD_CAST "records", NULL));
+    rec->count = 0;
+    rec->next = NULL;
+    return rec;
+}
+
+/**
+ *  copy the subtree of the reader's current node @node, expanded as
+ *  @tree, to @rec, with all the namespaces in scope
+ */
+static void
+valAddRecord(valRecord *rec, xmlNodePtr node, xmlNodePtr tree)
+{
+    xmlNodePtr copy = xmlDocCopyNode(tree, rec->doc, 1);
+    xmlNsPtr *list, *ns;
+
+    xmlAddChild(rec->doc->children, copy);
+    list = xmlGetNsList(node->doc, node);
+    for (ns = list; ns && *ns; ns++)
+        if (!xmlSearchNs(rec->doc, copy, (*ns)->prefix))
+            xmlNewNs(copy, (*ns)->href, (*ns)->prefix);
+    xmlFree(list);
+    rec->count++;
+}
+
+#define VAL_XSD_NS BAD_CAST "http://www.w3.org/2001/XMLSchema"
+
+/* elements the schema declares in a content model rather than globally,
+   by name and namespace: the records can't be checked against the
+   global declarations if one of them has the records' name */
+static xmlHashTablePtr valRecordLocals = NULL;
+
+/* the schema has identity constraints or ID types, which hold across
+   records: the document can only be validated as a whole */
+static int valRecordWhole = 0;
+
+/**
+ *  tell if the QName in attribute @attr of schema element @node names
+ *  one of the built-in ID types
+ */
+static int
+valIsIdType(xmlNodePtr node, const char *attr)
+{
+    xmlChar *value, *local, *prefix = NULL;
+    xmlNsPtr ns;
+    int ret = 0;
+
+    value = xmlGetProp(node, BAD_CAST attr);
+    if (!value) return 0;
+    local = xmlSplitQName2(value, &prefix);
+    ns = xmlSearchNs(node->doc, node, prefix);
+    if (ns && xmlStrEqual(ns->href, VAL_XSD_NS) &&
+        (xmlStrEqual(local? local : value, BAD_CAST "ID") ||
+         xmlStrEqual(local? local : value, BAD_CAST "IDREF") ||
+         xmlStrEqual(local? local : value, BAD_CAST "IDREFS")))
+        ret = 1;
+    xmlFree(prefix);
+    xmlFree(local);
+    xmlFree(value);
+    return ret;
+}
+
+/**
+ *  add the elements declared locally in the schema document @path, and in
+ *  the ones it includes or imports, to valRecordLocals, and set
+ *  valRecordWhole if it has identity constraints or ID types; @tns is the
+ *  target namespace of a document that includes it, if any
+ */
+static void
+valAddSchemaLocals(const xmlChar *path, const xmlChar *tns,
+    xmlHashTablePtr seen)
+{
+    xmlDocPtr doc;
+    xmlNodePtr root, cur;
+    xmlChar *target, *qualified, *form, *name, *loc, *uri;
+    const xmlChar *ns;
+
+    if (xmlHashLookup(seen, path)) return;
+    xmlHashAddEntry(seen, path, valShell);
+    doc = xmlReadFile((const char *) path, NULL, XML_PARSE_NOWARNING |
+        XML_PARSE_NOERROR);
+    root = xmlDocGetRootElement(doc);
+    if (!root || !root->ns || !xmlStrEqual(root->ns->href, VAL_XSD_NS))
+    {
+        xmlFreeDoc(doc);
+        return;
+    }
+    /* a schema without target namespace takes the one including it */
+    target = xmlGetProp(root, BAD_CAST "targetNamespace");
+    if (target) tns = target;
+    qualified = xmlGetProp(root, BAD_CAST "elementFormDefault");
+
+    for (cur = root; cur; )
+    {
+        if (cur->type == XML_ELEMENT_NODE && cur->ns &&
+            xmlStrEqual(cur->ns->href, VAL_XSD_NS))
+        {
+            if (xmlStrEqual(cur->name, BAD_CAST "unique") ||
+                xmlStrEqual(cur->name, BAD_CAST "key") ||
+                xmlStrEqual(cur->name, BAD_CAST "keyref") ||
+                valIsIdType(cur, "type") || valIsIdType(cur, "base") ||
+                valIsIdType(cur, "itemType"))
+                valRecordWhole = 1;
+            if (xmlStrEqual(cur->name, BAD_CAST "element") &&
+                cur->parent != root &&
+                (name = xmlGetProp(cur, BAD_CAST "name")) != NULL)
+            {
+                form = xmlGetProp(cur, BAD_CAST "form");
+                ns = xmlStrEqual(form? form : qualified,
+                    BAD_CAST "qualified")? tns : NULL;
+                xmlHashAddEntry2(valRecordLocals, name, ns, valShell);
+                xmlFree(form);
+                xmlFree(name);
+            }
+            else if (cur->parent == root &&
+                (xmlStrEqual(cur->name, BAD_CAST "include") ||
+                 xmlStrEqual(cur->name, BAD_CAST "redefine") ||
+                 xmlStrEqual(cur->name, BAD_CAST "import")) &&
+                (loc = xmlGetProp(cur, BAD_CAST "schemaLocation")) != NULL)
+            {
+                uri = xmlBuildURI(loc, doc->URL);
+                if (uri)
+                    valAddSchemaLocals(uri, xmlStrEqual(cur->name,
+                        BAD_CAST "import")? NULL : tns, seen);
+                xmlFree(uri);
+                xmlFree(loc);
+            }
+        }
+        /* next in document order */
+        if (cur->children && cur->type == XML_ELEMENT_NODE)
+            cur = cur->children;
+        else
+        {
+            while (cur && cur != root && !cur->next) cur = cur->parent;
+            cur = (cur && cur != root)? cur->next : NULL;
+        }
+    }
+    xmlFree(qualified);
+    xmlFree(target);
+    xmlFreeDoc(doc);
+}
+
+/**
+ *  validate the document opened by @reader against @schema, records
+ *  matching @pattern in @jobs threads; returns 0 if valid, 1 if not, or
+ *  -2 if a record has no global declaration, or has a local one, if
+ *  @pattern uses a prefix the root doesn't declare, or if the errors are
+ *  to be reported, and the document must be validated as a whole
+ */
+static int
+valRecordParallel(xmlTextReaderPtr reader, xmlSchemaPtr schema,
+    const char *pattern, int jobs, int dtdValid, ErrorInfo *errorInfo)
+{
+    valRecordQueue queue;
+    valRecord *batch = NULL;
+    void *error_ctxt = xmlStructuredErrorContext;
+    xmlStructuredErrorFunc error_func = xmlStructuredError;
+    pthread_t *threads;
+    int *started;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlPatternPtr comp = NULL;
+    xmlHashTablePtr tried;
+    xmlDocPtr env;
+    xmlNodePtr parent = NULL, node, copy;
+    long seq = 0;
+    int ret, failed = 0, i;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.schema = schema;
+    queue.max = jobs * 4;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.more, NULL);
+    pthread_cond_init(&queue.room, NULL);
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    tried = xmlHashCreate(8);
+    env = xmlNewDoc(BAD_CAST "1.0");
+
+    xmlInitParser();
+    threads = xmlMalloc(jobs * sizeof(pthread_t));
+    started = xmlMalloc(jobs * sizeof(int));
+    for (i = 0; i < jobs; i++)
+        started[i] = !pthread_create(&threads[i], NULL, valRecordWorker,
+            &queue);
+
+    /* parser errors make the document invalid too */
+    xmlSetStructuredErrorFunc(&queue, valRecordErrorFunc);
+    xmlTextReaderSchemaValidateCtxt(reader, NULL, 0);
+    ret = xmlTextReaderRead(reader);
+    while (ret == 1)
+    {
+        node = xmlTextReaderCurrentNode(reader);
+        switch (xmlTextReaderNodeType(reader))
+        {
+        case XML_READER_TYPE_ELEMENT:
+            if (!comp)
+            {
+                comp = valRecordPattern(pattern, node);
+                if (!comp)
+                {
+                    /* the prefixes are the root's, which can differ from
+                       one document to the next */
+                    fprintf(stderr, "%s: invalid record pattern '%s' with "
+                        "the prefixes declared on the root element\n",
+                        errorInfo->filename, pattern);
+                    queue.whole = 1;
+                    break;
+                }
+            }
+            if (parent && xmlPatternMatch(comp, node) == 1)
+            {
+                xmlNodePtr tree = xmlTextReaderExpand(reader);
+                const xmlChar *href = node->ns? node->ns->href : NULL;
+
+                if (!tree)
+                {
+                    ret = -1;
+                    continue;
+                }
+                copy = xmlDocCopyNode(node, env, 2);
+                copy->_private = valShell;
+                xmlAddChild(parent, copy);
+
+                /* with a local declaration too, which one applies
+                   depends on where the record is */
+                if (valRecordLocals &&
+                    xmlHashLookup2(valRecordLocals, node->name, href))
+                {
+                    queue.whole = 1;
+                    break;
+                }
+                if (!xmlHashLookup2(tried, node->name, href))
+                {
+                    /* the first record of a kind tells if the schema
+                       declares it globally */
+                    valRecord *rec = valNewRecords();
+                    valAddRecord(rec, node, tree);
+                    seq++;
+                    xmlHashAddEntry2(tried, node->name, href, valShell);
+                    valRecordValidate(&queue, vctxt, rec);
+                    if (queue.whole) break;
+                }
+                else
+                {
+                    if (!batch) batch = valNewRecords();
+                    valAddRecord(batch, node, tree);
+                    seq++;
+                    if (batch->count == VAL_RECORD_BATCH)
+                    {
+                        valRecordPush(&queue, batch);
+                        batch = NULL;
+                    }
+                }
+                ret = xmlTextReaderNext(reader);
+                continue;
+            }
+            copy = xmlDocCopyNode(node, env, 2);
+            if (parent)
+                xmlAddChild(parent, copy);
+            else
+                xmlDocSetRootElement(env, copy);
+            if (!xmlTextReaderIsEmptyElement(reader))
+                parent = copy;
+            break;
+        case XML_READER_TYPE_END_ELEMENT:
+            if (parent) parent = parent->parent;
+            if (parent && parent->type != XML_ELEMENT_NODE) parent = NULL;
+            break;
+        case XML_READER_TYPE_WHITESPACE:
+        case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+            /* next to elements, it can't make a difference */
+            if (parent && parent->last &&
+                parent->last->type == XML_ELEMENT_NODE)
+                break;
+            /* fall through */
+        case XML_READER_TYPE_TEXT:
+        case XML_READER_TYPE_CDATA:
+        case XML_READER_TYPE_ENTITY_REFERENCE:
+            if (parent)
+                xmlAddChild(parent, xmlDocCopyNode(node, env, 1));
+            break;
+        default:
+            break;
+        }
+        if (queue.whole) break;
+        ret = xmlTextReaderRead(reader);
+    }
+    xmlSetStructuredErrorFunc(error_ctxt, error_func);
+    if (batch) valRecordPush(&queue, batch);
+
+    pthread_mutex_lock(&queue.lock);
+    queue.done = 1;
+    pthread_cond_broadcast(&queue.more);
+    pthread_mutex_unlock(&queue.lock);
+    for (i = 0; i < jobs; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+    /* no thread to take them */
+    while (queue.head)
+    {
+        valRecord *rec = queue.head;
+        queue.head = rec->next;
+        valRecordValidate(&queue, vctxt, rec);
+    }
+
+    if (queue.whole)
+        failed = -2;
+    else
+    {
+        if (ret == 0 && xmlDocGetRootElement(env))
+        {
+            xmlSchemaSetValidStructuredErrors(vctxt, valEnvelopeErrorFunc,
+                &queue);
+            xmlSchemaValidateDoc(vctxt, env);
+        }
+        failed = ret != 0 || queue.errors > 0 ||
+            (dtdValid && xmlTextReaderIsValid(reader) != 1);
+
+        /* the errors are wanted where serial validation puts them */
+        if (failed && (errorInfo->verbose || valReportCur))
+            failed = -2;
+        else if (valReportCur)
+            valReportCur->elements += valCountElements(env->children) -
+                seq + queue.elements;
+    }
+
+    xmlFree(threads);
+    xmlFree(started);
+    xmlFreeDoc(env);
+    xmlHashFree(tried, NULL);
+    if (comp) xmlFreePattern(comp);
+    xmlSchemaFreeValidCtxt(vctxt);
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.more);
+    pthread_cond_destroy(&queue.room);
+    return failed;
+}
+
+#endif  /* HAVE_PTHREAD */
+
+#endif  /* LIBXML_SCHEMAS_ENABLED */
+
+/**
+ *  write @str to @out escaped for a JSON string or an XML attribute
+ */
+static void
+valReportEscape(xmlOutputBufferPtr out, const char *str, int json)
+{
+    const char *p, *start;
+    char esc[8];
+
+    for (p = start = str; *p; p++)
+    {
+        unsigned char c = *p;
+        const char *rep = NULL;
+
+        if (json)
+        {
+            if (c == '"') rep = "\\\"";
+            else if (c == '\\') rep = "\\\\";
+            else if (c < 0x20)
+            {
+                sprintf(esc, "\\u%04x", c);
+                rep = esc;
+            }
+        }
+        else
+        {
+            if (c == '<') rep = "&lt;";
+            else if (c == '>') rep = "&gt;";
+            else if (c == '&') rep = "&amp;";
+            else if (c == '"') rep = "&quot;";
+            else if (c == '\n') rep = "&#10;";
+            else if (c < 0x20 && c != '\t') rep = "?";
+        }
+        if (rep)
+        {
+            xmlOutputBufferWrite(out, p - start, start);
+            xmlOutputBufferWriteString(out, rep);
+            start = p + 1;
+        }
+    }
+    xmlOutputBufferWrite(out, p - start, start);
+}
+
+static void
+valReportPrintf(xmlOutputBufferPtr out, const char *fmt, double d)
+{
+    char buf[64];
+    sprintf(buf, fmt, d);
+    xmlOutputBufferWriteString(out, buf);
+}
+
+static void
+valReportJson(xmlOutputBufferPtr out, double mbps, long bytes, double seconds,
+    int invalid)
+{
+    int i, j;
+
+    xmlOutputBufferWriteString(out, "{\n  \"files\": [");
+    for (i = 0; i < valReportNr; i++)
+    {
+        valReportFile *rf = &valReport[i];
+
+        xmlOutputBufferWriteString(out, i? ",\n    {\"file\": \"" :
+            "\n    {\"file\": \"");
+        valReportEscape(out, rf->filename, 1);
+        xmlOutputBufferWriteString(out, rf->failed? "\", \"valid\": false" :
+            "\", \"valid\": true");
+        if (rf->cached)
+            xmlOutputBufferWriteString(out, ", \"cached\": true");
+        valReportPrintf(out, ", \"bytes\": %.0f", rf->bytes);
+        valReportPrintf(out, ", \"seconds\": %.6f", rf->seconds);
+        valReportPrintf(out, ", \"elements\": %.0f", rf->elements);
+        valReportPrintf(out, ", \"errors\": %.0f", rf->errors);
+        if (rf->errors)
+        {
+            xmlOutputBufferWriteString(out, ",\n     \"first_errors\": [");
+            for (j = 0; j < rf->errors && j < VAL_REPORT_ERRORS; j++)
+            {
+                valReportError *e = &rf->error[j];
+                xmlOutputBufferWriteString(out, j? ",\n       " :
+                    "\n       ");
+                valReportPrintf(out, "{\"domain\": %.0f", e->domain);
+                valReportPrintf(out, ", \"code\": %.0f", e->code);
+                valReportPrintf(out, ", \"line\": %.0f", e->line);
+                valReportPrintf(out, ", \"column\": %.0f", e->column);
+                xmlOutputBufferWriteString(out, ", \"message\": \"");
+                valReportEscape(out, (const char *) e->message, 1);
+                xmlOutputBufferWriteString(out, "\"}");
+            }
+            xmlOutputBufferWriteString(out, "]");
+        }
+        xmlOutputBufferWriteString(out, "}");
+    }
+    valReportPrintf(out, "],\n  \"totals\": {\"files\": %.0f", valReportNr);
+    valReportPrintf(out, ", \"valid\": %.0f", valReportNr - invalid);
+    valReportPrintf(out, ", \"invalid\": %.0f", invalid);
+    valReportPrintf(out, ", \"bytes\": %.0f", bytes);
+    valReportPrintf(out, ", \"seconds\": %.6f", seconds);
+    valReportPrintf(out, ", \"mb_per_second\": %.3f}\n}\n", mbps);
+}
+
+static void
+valReportJunit(xmlOutputBufferPtr out, double mbps, long bytes, double seconds,
+    int invalid)
+{
+    int i, j;
+    char buf[64];
+
+    xmlOutputBufferWriteString(out, "<?xml version=\"1.0\"?>\n"
+        "<testsuite name=\"xmlstarlet val\"");
+    valReportPrintf(out, " tests=\"%.0f\"", valReportNr);
+    valReportPrintf(out, " failures=\"%.0f\"", invalid);
+    valReportPrintf(out, " time=\"%.6f\">\n  <properties>\n", seconds);
+    valReportPrintf(out,
+        "    <property name=\"bytes\" value=\"%.0f\"/>\n", bytes);
+    valReportPrintf(out,
+        "    <property name=\"mb_per_second\" value=\"%.3f\"/>\n", mbps);
+    xmlOutputBufferWriteString(out, "  </properties>\n");
+    for (i = 0; i < valReportNr; i++)
+    {
+        valReportFile *rf = &valReport[i];
+
+        xmlOutputBufferWriteString(out,
+            "  <testcase classname=\"val\" name=\"");
+        valReportEscape(out, rf->filename, 0);
+        valReportPrintf(out, "\" time=\"%.6f\">\n", rf->seconds);
+        xmlOutputBufferWriteString(out, "    <properties>\n");
+        valReportPrintf(out,
+            "      <property name=\"bytes\" value=\"%.0f\"/>\n", rf->bytes);
+        valReportPrintf(out,
+            "      <property name=\"elements\" value=\"%.0f\"/>\n",
+            rf->elements);
+        if (rf->cached)
+            xmlOutputBufferWriteString(out,
+                "      <property name=\"cached\" value=\"true\"/>\n");
+        xmlOutputBufferWriteString(out, "    </properties>\n");
+        if (rf->failed)
+        {
+            sprintf(buf, "%d error%s", rf->errors, rf->errors == 1? "" : "s");
+            xmlOutputBufferWriteString(out, "    <failure type=\"invalid\" "
+                "message=\"");
+            xmlOutputBufferWriteString(out, buf);
+            xmlOutputBufferWriteString(out, "\">");
+            for (j = 0; j < rf->errors && j < VAL_REPORT_ERRORS; j++)
+            {
+                valReportError *e = &rf->error[j];
+                sprintf(buf, "%s%d.%d: [%d/%d] ", j? "&#10;" : "",
+                    e->line, e->column, e->domain, e->code);
+                xmlOutputBufferWriteString(out, buf);
+                valReportEscape(out, (const char *) e->message, 0);
+            }
+            xmlOutputBufferWriteString(out, "</failure>\n");
+        }
+        xmlOutputBufferWriteString(out, "  </testcase>\n");
+    }
+    xmlOutputBufferWriteString(out, "</testsuite>\n");
+}
+
+/**
+ *  write report collected for all files, and free it
+ */
+static int
+valReportWrite(valOptionsPtr ops)
+{
+    xmlOutputBufferPtr out;
+    long bytes = 0;
+    double seconds = 0;
+    int i, j, invalid = 0;
+
+    out = xmlOutputBufferCreateFilename(ops->report, NULL, 0);
+    if (!out)
+    {
+        fprintf(stderr, "couldn't write report '%s'\n", ops->report);
+        return -1;
+    }
+    for (i = 0; i < valReportNr; i++)
+    {
+        bytes += valReport[i].bytes;
+        seconds += valReport[i].seconds;
+        if (valReport[i].failed) invalid++;
+    }
+    if (ops->reportJunit)
+        valReportJunit(out, seconds > 0? bytes / 1e6 / seconds : 0, bytes,
+            seconds, invalid);
+    else
+        valReportJson(out, seconds > 0? bytes / 1e6 / seconds : 0, bytes,
+            seconds, invalid);
+
+    for (i = 0; i < valReportNr; i++)
+        for (j = 0; j < valReport[i].errors && j < VAL_REPORT_ERRORS; j++)
+            xmlFree(valReport[i].error[j].message);
+    xmlFree(valReport);
+    valReport = NULL;
+    valReportNr = valReportMax = 0;
+    return xmlOutputBufferClose(out) < 0? -1 : 0;
+}
+
+/* input is fed to the well-formedness parser in blocks of this size */
+#define VAL_BLOCK_SIZE (256 * 1024)
+
+static void
+valCountElement(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI,
+    int nb_namespaces, const xmlChar **namespaces,
+    int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    valReportCur->elements++;
+}
+
+/**
+ *  create push parser context that checks well-formedness only: nothing
+ *  but the DTD declarations, which entity references need, is kept
+ */
+static xmlParserCtxtPtr
+valNewWellFormedCtxt(valOptionsPtr ops)
+{
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+
+    xmlSAXVersion(&sax, 2);
+    sax.startElementNs = ops->report? valCountElement : NULL;
+    sax.endElementNs = NULL;
+    sax.startElement = NULL;
+    sax.endElement = NULL;
+    sax.characters = NULL;
+    sax.ignorableWhitespace = NULL;
+    sax.cdataBlock = NULL;
+    sax.comment = NULL;
+    sax.processingInstruction = NULL;
+    sax.reference = NULL;
+
+    ctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL);
+    if (!ctxt)
+    {
+        xmlGenericError(xmlGenericErrorContext,
+            "Couldn't allocate parser context\n");
+        exit(EXIT_INTERNAL_ERROR);
+    }
+    return ctxt;
+}
+
+/**
+ *  check well-formedness of @filename, or of its content in @mem if not
+ *  NULL, with @ctxt from valNewWellFormedCtxt(); returns 0 if it is well
+ *  formed, 1 if not and -1 if the file couldn't be read
+ */
+static int
+valWellFormed(xmlParserCtxtPtr ctxt, const char *filename, const FileMap *mem,
+    int options)
+{
+    static char block[VAL_BLOCK_SIZE];
+    xmlParserInputBufferPtr in = NULL;
+    size_t pos = 0;
+    int n, failed;
+
+    if (mem)
+    {
+        n = mem->size < VAL_BLOCK_SIZE? mem->size : VAL_BLOCK_SIZE;
+        xmlCtxtResetPush(ctxt, mem->data, n, filename, NULL);
+        pos = n;
+    }
+    else
+    {
+        /* libxml2's own input handles stdin and compressed files */
+        in = xmlParserInputBufferCreateFilename(filename,
+            XML_CHAR_ENCODING_NONE);
+        if (!in) return -1;
+        n = in->readcallback(in->context, block, VAL_BLOCK_SIZE);
+        if (n < 0) n = 0;
+        xmlCtxtResetPush(ctxt, block, n, filename, NULL);
+    }
+    xmlCtxtUseOptions(ctxt, options);
+
+    do
+    {
+        if (mem)
+        {
+            n = mem->size - pos < VAL_BLOCK_SIZE? mem->size - pos :
+                VAL_BLOCK_SIZE;
+            xmlParseChunk(ctxt, mem->data + pos, n, n == 0);
+            pos += n;
+        }
+        else
+        {
+            n = in->readcallback(in->context, block, VAL_BLOCK_SIZE);
+            if (n < 0) n = 0;
+            xmlParseChunk(ctxt, block, n, n == 0);
+        }
+        /* the parser gives up at the first fatal error */
+    } while (n > 0 && ctxt->wellFormed);
+    if (in) xmlFreeParserInputBuffer(in);
+
+    failed = !ctxt->wellFormed;
+    xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+    return failed;
+}
+
+/*
+ *  --split-parallel: the children of the root element are split into one
+ *  chunk per thread, at line ends between two children, and each chunk is
+ *  checked on its own, after a copy of the root start tag.  Errors are put
+ *  back at their place in the whole file.
+ */
+
+/* smaller chunks aren't worth a thread */
+#define VAL_MIN_CHUNK (64 * 1024)
+
+typedef struct _valChunk {
+    const char *data;         /* part of the file checked by this chunk */
+    size_t size;
+    const char *prefix;       /* root start tag and newline, if data lacks it */
+    int prefix_size;
+    const char *suffix;       /* root end tag, if data lacks it */
+    int options;
+    int countElements;
+    int wellFormed;
+    int unsure;               /* error at the seams, check the whole file */
+    long lines;               /* newlines in data */
+    long elements;
+    xmlError *errors;
+    long *offsets;            /* where each error is in data */
+    int errorsNr;
+    int errorsMax;
+} valChunk;
+
+static void
+valChunkError(void *userData, xmlErrorPtr error)
+{
+    valChunk *chunk = userData;
+    xmlParserCtxtPtr ctxt = error->ctxt;
+    long off;
+
+    if (!ctxt || !ctxt->input ||
+        (error->domain != XML_FROM_PARSER &&
+         error->domain != XML_FROM_NAMESPACE))
+    {
+        chunk->unsure = 1;
+        return;
+    }
+    off = ctxt->input->consumed + (ctxt->input->cur - ctxt->input->base) -
+        chunk->prefix_size;
+    /* the copy of the root start tag was checked with the first chunk */
+    if (off < 0) return;
+    if (chunk->suffix && off >= (long) chunk->size)
+    {
+        chunk->unsure = 1;
+        return;
+    }
+    if (chunk->errorsNr == chunk->errorsMax)
+    {
+        chunk->errorsMax = chunk->errorsMax? chunk->errorsMax * 2 : 8;
+        chunk->errors = xmlRealloc(chunk->errors,
+            chunk->errorsMax * sizeof(xmlError));
+        chunk->offsets = xmlRealloc(chunk->offsets,
+            chunk->errorsMax * sizeof(long));
+    }
+    memset(&chunk->errors[chunk->errorsNr], 0, sizeof(xmlError));
+    xmlCopyError(error, &chunk->errors[chunk->errorsNr]);
+    chunk->offsets[chunk->errorsNr++] = off;
+}
+
+static void
+valChunkCountElement(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI,
+    int nb_namespaces, const xmlChar **namespaces,
+    int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    ((valChunk *) ctx)->elements++;
+}
+
+static void *
+valChunkCheck(void *arg)
+{
+    valChunk *chunk = arg;
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+    const char *p, *end;
+    size_t pos, n;
+
+    /* nothing but errors: there is no DTD to keep */
+    memset(&sax, 0, sizeof(sax));
+    sax.initialized = XML_SAX2_MAGIC;
+    sax.serror = valChunkError;
+    if (chunk->countElements)
+        sax.startElementNs = valChunkCountElement;
+
+    xmlSetStructuredErrorFunc(chunk, valChunkError);
+    ctxt = xmlCreatePushParserCtxt(&sax, chunk, chunk->prefix,
+        chunk->prefix_size, NULL);
+    if (!ctxt)
+    {
+        chunk->unsure = 1;
+        return NULL;
+    }
+    xmlCtxtUseOptions(ctxt, chunk->options);
+    for (pos = 0; pos < chunk->size && ctxt->wellFormed; pos += n)
+    {
+        n = chunk->size - pos < VAL_BLOCK_SIZE? chunk->size - pos :
+            VAL_BLOCK_SIZE;
+        xmlParseChunk(ctxt, chunk->data + pos, n, 0);
+    }
+    if (ctxt->wellFormed)
+        xmlParseChunk(ctxt, chunk->suffix? chunk->suffix : "",
+            chunk->suffix? strlen(chunk->suffix) : 0, 1);
+    chunk->wellFormed = ctxt->wellFormed;
+    xmlFreeParserCtxt(ctxt);
+
+    for (p = chunk->data, end = p + chunk->size;
+         (p = memchr(p, '\n', end - p)) != NULL; p++)
+        chunk->lines++;
+    return NULL;
+}
+
+/* find @str in [@p, @end) */
+static const char *
+valFind(const char *p, const char *end, const char *str)
 {
-    ops->wellFormed = 1;
-    ops->err = 0;
-    ops->stop = 0;
-    ops->embed = 0;
-    ops->dtd = NULL;
-    ops->schema = NULL;
-    ops->relaxng = NULL;
-    ops->nonet = 1;
+    size_t len = strlen(str);
 
-    if (globalOptions.quiet) {
-        ops->listGood = 0;
-        ops->show_val_res = 0;
-    } else {
-        ops->listGood = -1;
-        ops->show_val_res = 1;
+    while ((p = memchr(p, str[0], end - p)) != NULL)
+    {
+        if ((size_t) (end - p) < len) return NULL;
+        if (!memcmp(p, str, len)) return p;
+        p++;
+    }
+    return NULL;
+}
+
+/* end of the tag starting at @p, skipping quoted attribute values */
+static const char *
+valTagEnd(const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        if (*p == '"' || *p == '\'')
+        {
+            p = memchr(p + 1, *p, end - p - 1);
+            if (!p) return NULL;
+        }
+        else if (*p == '>')
+            return p;
     }
+    return NULL;
 }
 
 /**
- *  Parse global command line options
+ *  find the root start tag in @data, if what comes before it lets the
+ *  document be split: UTF-8 and no DOCTYPE
  */
-int
-valParseOptions(valOptionsPtr ops, int argc, char **argv)
+static const char *
+valSplitRoot(const char *data, const char *end)
 {
-    int i;
+    const char *p = data;
 
-    i = 2;
-    while(i < argc)
+    if (end - p >= 3 && !memcmp(p, "\xEF\xBB\xBF", 3)) p += 3;
+    if (end - p >= 5 && !memcmp(p, "<?xml", 5) && IS_BLANK_CH(p[5]))
     {
-        if (!strcmp(argv[i], "--well-formed") || !strcmp(argv[i], "-w"))
-        {
-            ops->wellFormed = 1;
-            i++;
-        }
-        else if (!strcmp(argv[i], "--err") || !strcmp(argv[i], "-e"))
-        {
-            ops->err = 1;
-            i++;
-        }
-        else if (!strcmp(argv[i], "--stop") || !strcmp(argv[i], "-S"))
-        {
-            ops->stop = STOP;
-            i++;
-        }
-        else if (!strcmp(argv[i], "--embed") || !strcmp(argv[i], "-E"))
-        {
-            ops->embed = 1;
-            i++;
-        }
-        else if (!strcmp(argv[i], "--list-good") || !strcmp(argv[i], "-g"))
-        {
-            ops->listGood = 1;
-            ops->show_val_res = 0;
-            i++;
-        }
-        else if (!strcmp(argv[i], "--list-bad") || !strcmp(argv[i], "-b"))
+        const char *decl_end = valFind(p, end, "?>");
+        const char *enc;
+
+        if (!decl_end) return NULL;
+        enc = valFind(p, decl_end, "encoding");
+        if (enc)
         {
-            ops->listGood = -1;
-            ops->show_val_res = 0;
-            i++;
+            enc = memchr(enc, '=', decl_end - enc);
+            while (enc && enc < decl_end && *enc != '"' && *enc != '\'') enc++;
+            if (!enc || enc >= decl_end) return NULL;
+            enc++;
+            if (xmlStrncasecmp(BAD_CAST enc, BAD_CAST "UTF-8", 5) &&
+                xmlStrncasecmp(BAD_CAST enc, BAD_CAST "US-ASCII", 8) &&
+                xmlStrncasecmp(BAD_CAST enc, BAD_CAST "ASCII", 5))
+                return NULL;
         }
-        else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-q"))
+        p = decl_end + 2;
+    }
+    while (p < end)
+    {
+        if (IS_BLANK_CH(*p))
+            p++;
+        else if (end - p >= 4 && !memcmp(p, "<!--", 4))
         {
-            ops->listGood = 0;
-            ops->show_val_res = 0;
-            i++;
+            p = valFind(p + 4, end, "-->");
+            if (!p) return NULL;
+            p += 3;
         }
-        else if (!strcmp(argv[i], "--dtd") || !strcmp(argv[i], "-d"))
+        else if (end - p >= 2 && !memcmp(p, "<?", 2))
         {
-            i++;
-            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
-            ops->dtd = argv[i];
-            i++;
+            p = valFind(p + 2, end, "?>");
+            if (!p) return NULL;
+            p += 2;
         }
-        else if (!strcmp(argv[i], "--xsd") || !strcmp(argv[i], "-s"))
+        else if (*p == '<' && end - p >= 2 && p[1] != '!')
+            return p;
+        else
+            return NULL;      /* DOCTYPE, or not XML at all */
+    }
+    return NULL;
+}
+
+/**
+ *  look for up to @max split points after @body, the content of the root
+ *  element: starts of lines between its children, about evenly spaced;
+ *  returns the number found
+ */
+static int
+valSplitPoints(const char *data, const char *body, const char *end,
+    const char **splits, int max)
+{
+    const char *p = body, *q, *r, *target;
+    int depth = 1, found = 0;
+
+    target = data + (end - data) / (max + 1);
+    while (p < end && depth > 0 && found < max)
+    {
+        q = memchr(p, '<', end - p);
+        if (!q || q + 1 >= end) break;
+
+        /* text at the top level */
+        while (depth == 1 && found < max && q > target)
         {
-            i++;
-            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
-            ops->schema = argv[i];
-            i++;
+            const char *from = p > target? p : target;
+            const char *nl = memchr(from, '\n', q - from);
+            if (!nl) break;
+            splits[found++] = nl + 1;
+            target = data + (end - data) / (max + 1) * (found + 1);
+            if (target <= nl) target = nl + 1;
         }
-        else if (!strcmp(argv[i], "--relaxng") || !strcmp(argv[i], "-r"))
+
+        if (q[1] == '/')
         {
-            i++;
-            if (i >= argc) valUsage(argc, argv, EXIT_BAD_ARGS);
-            ops->relaxng = argv[i];
-            i++;
+            r = memchr(q, '>', end - q);
+            depth--;
         }
-        else if (!strcmp(argv[i], "--net"))
+        else if (q[1] == '?')
         {
-            ops->nonet = 0;
-            i++;
+            r = valFind(q, end, "?>");
+            if (r) r++;
         }
-        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+        else if (q[1] == '!')
         {
-            valUsage(argc, argv, EXIT_SUCCESS);
+            if (valFind(q, q + 4 < end? q + 4 : end, "<!--") == q)
+                r = valFind(q + 4, end, "-->");
+            else if (end - q >= 9 && !memcmp(q, "<![CDATA[", 9))
+                r = valFind(q + 9, end, "]]>");
+            else
+                break;
+            if (r) r += 2;
         }
-        else if (!strcmp(argv[i], "-"))
+        else
         {
-            i++;
-            break;
+            r = valTagEnd(q, end);
+            if (r && r[-1] != '/') depth++;
         }
-        else if (argv[i][0] == '-')
+        if (!r) break;
+        p = r + 1;
+    }
+    return found;
+}
+
+/**
+ *  some messages give the line of the start tag of an element: put there
+ *  the line @line counted in the whole file
+ */
+static void
+valChunkMessageLine(xmlErrorPtr error, int line)
+{
+    char old[32], *at, *msg;
+
+    if (error->code != XML_ERR_TAG_NAME_MISMATCH &&
+        error->code != XML_ERR_TAG_NOT_FINISHED &&
+        error->code != XML_ERR_GT_REQUIRED)
+        return;
+    sprintf(old, " line %d", error->int1);
+    at = error->message? strstr(error->message, old) : NULL;
+    if (!at) return;
+    msg = xmlMalloc(strlen(error->message) + 32);
+    sprintf(msg, "%.*s line %d%s", (int) (at - error->message),
+        error->message, line, at + strlen(old));
+    xmlFree(error->message);
+    error->message = msg;
+    error->int1 = line;
+}
+
+/**
+ *  check well-formedness of @filename, or of its content in @mem, in
+ *  chunks checked by @jobs threads; returns 0 if it is well formed, 1 if
+ *  not, and -2 if the file can't be split (or the result is unsure) and
+ *  must be checked as a whole
+ */
+static int
+valWellFormedParallel(const char *filename, const FileMap *mem, int options,
+    int jobs, int verbose)
+{
+    FileMap map;
+    const char *data, *end, *root, *tag_end, *name_end;
+    const char **splits = NULL;
+    char *prefix = NULL, *suffix = NULL;
+    valChunk *chunks = NULL;
+    int nsplits, nchunks, i, j, ret = -2;
+    long line, root_line;
+#ifdef HAVE_PTHREAD
+    pthread_t *threads;
+    int *started;
+#endif
+
+    if (jobs < 2 || !strcmp(filename, "-")) return -2;
+    if (!mem)
+    {
+        if (fileMapOpen(&map, filename) != 0) return -2;
+        mem = &map;
+    }
+    data = mem->data;
+    end = data + mem->size;
+    if (mem->size / jobs < VAL_MIN_CHUNK)
+        jobs = mem->size / VAL_MIN_CHUNK;
+    if (jobs < 2) goto done;
+
+    root = valSplitRoot(data, end);
+    if (!root) goto done;
+    tag_end = valTagEnd(root, end);
+    if (!tag_end || tag_end[-1] == '/') goto done;
+    for (name_end = root + 1;
+         name_end < tag_end && !IS_BLANK_CH(*name_end); name_end++)
+        ;
+
+    splits = xmlMalloc((jobs - 1) * sizeof(char *));
+    nsplits = valSplitPoints(data, tag_end + 1, end, splits, jobs - 1);
+    if (nsplits == 0) goto done;
+    nchunks = nsplits + 1;
+
+    prefix = xmlMalloc(tag_end - root + 2);
+    memcpy(prefix, root, tag_end - root + 1);
+    prefix[tag_end - root + 1] = '\n';
+    suffix = xmlMalloc(name_end - root + 3);
+    sprintf(suffix, "</%.*s>", (int) (name_end - root - 1), root + 1);
+
+    chunks = xmlMalloc(nchunks * sizeof(valChunk));
+    memset(chunks, 0, nchunks * sizeof(valChunk));
+    for (i = 0; i < nchunks; i++)
+    {
+        valChunk *chunk = &chunks[i];
+        chunk->data = i? splits[i-1] : data;
+        chunk->size = (i < nsplits? splits[i] : end) - chunk->data;
+        if (i)
         {
-            valUsage(argc, argv, EXIT_BAD_ARGS);
+            chunk->prefix = prefix;
+            chunk->prefix_size = tag_end - root + 2;
         }
+        if (i < nsplits) chunk->suffix = suffix;
+        chunk->options = options;
+        chunk->countElements = valReportCur != NULL;
+    }
+
+    /* first chunk on this thread, the others on their own */
+    xmlInitParser();
+#ifdef HAVE_PTHREAD
+    threads = xmlMalloc(nchunks * sizeof(pthread_t));
+    started = xmlMalloc(nchunks * sizeof(int));
+    for (i = 1; i < nchunks; i++)
+        started[i] = !pthread_create(&threads[i], NULL, valChunkCheck,
+            &chunks[i]);
+    {
+        void *error_ctxt = xmlStructuredErrorContext;
+        xmlStructuredErrorFunc error_func = xmlStructuredError;
+        valChunkCheck(&chunks[0]);
+        xmlSetStructuredErrorFunc(error_ctxt, error_func);
+    }
+    for (i = 1; i < nchunks; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
         else
+            valChunkCheck(&chunks[i]);
+    }
+    xmlFree(threads);
+    xmlFree(started);
+#else
+    {
+        void *error_ctxt = xmlStructuredErrorContext;
+        xmlStructuredErrorFunc error_func = xmlStructuredError;
+        for (i = 0; i < nchunks; i++)
+            valChunkCheck(&chunks[i]);
+        xmlSetStructuredErrorFunc(error_ctxt, error_func);
+    }
+#endif
+
+    /* errors as a serial check would give them: in order, up to the
+       first fatal one */
+    for (i = 0; i < nchunks && chunks[i].wellFormed; i++)
+        if (chunks[i].unsure) goto done;
+    if (i < nchunks && chunks[i].unsure) goto done;
+
+    root_line = 1;
+    for (tag_end = data; (tag_end = memchr(tag_end, '\n', root - tag_end));
+         tag_end++)
+        root_line++;
+    line = 0;
+    for (i = 0; i < nchunks; i++)
+    {
+        valChunk *chunk = &chunks[i];
+        int prefix_lines = 0;
+
+        for (j = 0; j < chunk->prefix_size; j++)
+            if (chunk->prefix[j] == '\n') prefix_lines++;
+        for (j = 0; j < chunk->errorsNr; j++)
         {
-            i++;
-            break;
+            xmlError error = chunk->errors[j];
+
+            error.line += line - prefix_lines;
+            if (i)
+                valChunkMessageLine(&chunk->errors[j],
+                    chunk->errors[j].int1 > prefix_lines?
+                    chunk->errors[j].int1 + line - prefix_lines :
+                    root_line + chunk->errors[j].int1 - 1);
+            error.message = chunk->errors[j].message;
+            error.int1 = chunk->errors[j].int1;
+            error.file = NULL;
+            error.ctxt = NULL;
+            xmlStructuredError(xmlStructuredErrorContext, &error);
+            if (verbose)
+            {
+                xmlParserInput input;
+                memset(&input, 0, sizeof(input));
+                input.base = BAD_CAST data;
+                input.cur = BAD_CAST chunk->data + chunk->offsets[j];
+                input.end = BAD_CAST end;
+                xmlParserPrintFileContext(&input);
+            }
         }
+        if (valReportCur)
+            valReportCur->elements += chunk->elements - (i? 1 : 0);
+        line += chunk->lines;
+        if (!chunk->wellFormed) break;
     }
+    ret = i < nchunks;
 
-    return i-1;
+done:
+    if (chunks)
+    {
+        for (i = 0; i < nchunks; i++)
+        {
+            for (j = 0; j < chunks[i].errorsNr; j++)
+                xmlResetError(&chunks[i].errors[j]);
+            xmlFree(chunks[i].errors);
+            xmlFree(chunks[i].offsets);
+        }
+        xmlFree(chunks);
+    }
+    xmlFree(splits);
+    xmlFree(prefix);
+    xmlFree(suffix);
+    if (mem == &map) fileMapClose(&map);
+    return ret;
 }
 
 /**
- *  Validate XML document against DTD
+ *  Report result of validating document just parsed with @ctxt against DTD
  */
 int
-valAgainstDtd(valOptionsPtr ops, char* dtdvalid, xmlDocPtr doc, char* filename)
+valAgainstDtd(valOptionsPtr ops, char* dtdvalid, xmlParserCtxtPtr ctxt,
+    char* filename)
 {
     int result = 0;
 
-    if (dtdvalid != NULL)
+    if (!ctxt->valid)
     {
-        xmlDtdPtr dtd;
-
-#if !defined(LIBXML_VALID_ENABLED)
-	xmlGenericError(xmlGenericErrorContext,
-	"libxml2 has no validation support");
-	return 2;
-#endif
-        dtd = xmlParseDTD(NULL, (const xmlChar *)dtdvalid);
-        if (dtd == NULL)
+        if ((ops->listGood < 0) && !ops->show_val_res)
         {
-            xmlGenericError(xmlGenericErrorContext,
-            "Could not parse DTD %s\n", dtdvalid);
-            result = 2;
+            fprintf(stdout, "%s\n", filename);
         }
-        else
+        else if (ops->listGood == 0 && dtdvalid)
+            xmlGenericError(xmlGenericErrorContext,
+                            "%s: does not match %s\n",
+                            filename, dtdvalid);
+        result = 3;
+    }
+    else
+    {
+        if ((ops->listGood > 0) && !ops->show_val_res)
         {
-            xmlValidCtxtPtr cvp;
-
-            if ((cvp = xmlNewValidCtxt()) == NULL) 
-            {
-                xmlGenericError(xmlGenericErrorContext,
-                    "Couldn't allocate validation context\n");
-                exit(-1);
-            }
-        
-            if (ops->err)
-            {
-                cvp->userData = (void *) stderr;
-                cvp->error    = (xmlValidityErrorFunc) fprintf;
-                cvp->warning  = (xmlValidityWarningFunc) fprintf;
-            }
-            else
-            {
-                cvp->userData = (void *) NULL;
-                cvp->error    = (xmlValidityErrorFunc) NULL;
-                cvp->warning  = (xmlValidityWarningFunc) NULL;
-            }
-                        
-            if (!xmlValidateDtd(cvp, doc, dtd))
-            {
-                if ((ops->listGood < 0) && !ops->show_val_res)
-                {
-                    fprintf(stdout, "%s\n", filename);
-                }
-                else if (ops->listGood == 0)
-                    xmlGenericError(xmlGenericErrorContext,
-                                    "%s: does not match %s\n",
-                                    filename, dtdvalid);
-                result = 3;
-            }
-            else
-            {
-                if ((ops->listGood > 0) && !ops->show_val_res)
-                {
-                    fprintf(stdout, "%s\n", filename);
-                }
-            }
-            xmlFreeDtd(dtd);
-            xmlFreeValidCtxt(cvp);
+            fprintf(stdout, "%s\n", filename);
         }
     }
 
@@ -290,42 +2629,106 @@ valMain(int argc, char **argv)
     static ErrorInfo errorInfo;
     int invalidFound = 0;
     int options = XML_PARSE_DTDLOAD | XML_PARSE_DTDATTR;
+    xxh64State schemaHash;
+    uint64_t key = 0;
+    xmlBufferPtr deps = NULL;
 
     if (argc <= 2) valUsage(argc, argv, EXIT_BAD_ARGS);
     valInitOptions(&ops);
     start = valParseOptions(&ops, argc, argv);
+    if (ops.schemaMap && (ops.dtd || ops.schema || ops.relaxng))
+        valUsage(argc, argv, EXIT_BAD_ARGS);
+    if (ops.recordPattern && (!ops.schema || ops.dtd))
+        valUsage(argc, argv, EXIT_BAD_ARGS);
     if (ops.nonet) options |= XML_PARSE_NONET;
 
     errorInfo.verbose = ops.err;
-    xmlSetStructuredErrorFunc(&errorInfo, reportError);
+    xmlSetStructuredErrorFunc(&errorInfo,
+        ops.report? valReportErrorFunc : reportError);
     xmlLineNumbersDefault(1);
+    if (ops.cache) deps = xmlBufferCreate();
 
-    if (ops.dtd)
+    if (ops.dtd ||
+        (ops.embed && !ops.schema && !ops.relaxng && !ops.schemaMap))
     {
         /* xmlReader doesn't work with external dtd, have to use SAX
-         * interface */
+         * interface; it's also where external DTDs are shared */
         int i;
+        xmlParserCtxtPtr ctxt = NULL;
 
         /* we have to exit() from the error reporting function to implement
            --stop */
         errorInfo.stop = ops.stop;
 
+#if !defined(LIBXML_VALID_ENABLED)
+        xmlGenericError(xmlGenericErrorContext,
+            "libxml2 has no validation support");
+#else
+        valCacheBeginSchemas(&ops, &schemaHash);
+        if (ops.dtd)
+            valDtd = xmlParseDTD(NULL, (const xmlChar *) ops.dtd);
+        if (ops.dtd && valDtd == NULL)
+        {
+            xmlGenericError(xmlGenericErrorContext,
+                "Could not parse DTD %s\n", ops.dtd);
+        }
+        else
+        {
+            ctxt = valNewDtdCtxt();
+        }
+#endif
+        options |= XML_PARSE_DTDVALID;
+        key = valCacheEndSchemas(&ops, options);
+
         for (i=start; i<argc; i++)
         {
             xmlDocPtr doc;
             int failed;
+            FileMap map;
+            int mapped;
+            int cached = 0;
+            uint64_t content;
 
             failed = 0;
             doc = NULL;
 
             errorInfo.filename = argv[i];
-            doc = xmlReadFile(argv[i], NULL, options);
+            valReportBegin(&ops, argv[i]);
+            mapped = ctxt && valCacheOpen(&ops, argv[i], &map);
+            if (mapped && valCacheLookup(&ops, key, &map, &content))
+            {
+                cached = 1;
+                if ((ops.listGood > 0) && !ops.show_val_res)
+                    fprintf(stdout, "%s\n", argv[i]);
+                fileMapClose(&map);
+                goto dtdResult;
+            }
+            if (mapped)
+            {
+                xmlBufferEmpty(deps);
+                valDepsUncacheable = 0;
+                valDeps = deps;
+            }
+            if (mapped && valCacheParseMapped(&map))
+            {
+                valMapReader r;
+                r.map = &map;
+                r.pos = 0;
+                doc = xmlCtxtReadIO(ctxt, valMapRead, NULL, &r, argv[i],
+                    NULL, options);
+            }
+            else if (ctxt)
+                doc = xmlCtxtReadFile(ctxt, argv[i], NULL, options);
+            valDeps = NULL;
             if (doc)
             {
-                /* TODO: precompile DTD once */                
-                failed = valAgainstDtd(&ops, ops.dtd, doc, argv[i]);
+                failed = valAgainstDtd(&ops, ops.dtd, ctxt, argv[i]);
                 xmlFreeDoc(doc);
             }
+            else if (!ctxt)
+            {
+                failed = 2; /* no DTD */
+            }
             else
             {
                 failed = 1; /* Malformed XML or could not open file */
@@ -334,8 +2737,16 @@ valMain(int argc, char **argv)
                     fprintf(stdout, "%s\n", argv[i]);
                 }
             }
+            if (mapped)
+            {
+                if (!failed && !valDepsUncacheable)
+                    valCacheStore(&ops, key, &map, content, deps);
+                fileMapClose(&map);
+            }
             if (failed) invalidFound = 1;
 
+        dtdResult:
+            valReportEnd(failed, cached, ctxt? xmlByteConsumed(ctxt) : 0);
             if (ops.show_val_res)
             {
                 if (!failed)
@@ -344,6 +2755,8 @@ valMain(int argc, char **argv)
                     fprintf(stdout, "%s - invalid\n", argv[i]);
             }
         }
+        if (ctxt) valFreeDtdCtxt(ctxt);
+        xmlFreeDtd(valDtd);
     }
     else if (ops.schema || ops.relaxng || ops.embed || ops.wellFormed)
     {
@@ -358,9 +2771,28 @@ valMain(int argc, char **argv)
         xmlRelaxNGPtr relaxng = NULL;
         xmlRelaxNGParserCtxtPtr relaxngParserCtxt = NULL;
         /* there is no xmlTextReaderRelaxNGValidateCtxt() !?  */
+        xmlTextReaderPtr peek = NULL;
+#endif  /* LIBXML_SCHEMAS_ENABLED */
+        xmlParserCtxtPtr wfCtxt = NULL;
+#ifdef LIBXML_SCHEMAS_ENABLED
 
         /* TODO: Do not print debug stuff */
-        if (ops.schema)
+        valCacheBeginSchemas(&ops, &schemaHash);
+        if (ops.schemaMap)
+        {
+            if (ops.cache)
+            {
+                uint64_t h;
+                if (valHashFile(ops.schemaMap, &h) == 0)
+                    xxh64Update(&schemaHash, &h, sizeof(h));
+            }
+            if (valLoadSchemaMap(ops.schemaMap, &errorInfo) != 0)
+            {
+                invalidFound = 2;
+                goto schemaCleanup;
+            }
+        }
+        else if (ops.schema)
         {
             schemaParserCtxt = xmlSchemaNewParserCtxt(ops.schema);
             if (!schemaParserCtxt)
@@ -377,6 +2809,15 @@ valMain(int argc, char **argv)
             }
 
             xmlSchemaFreeParserCtxt(schemaParserCtxt);
+#ifdef HAVE_PTHREAD
+            if (ops.recordPattern && ops.jobs > 1)
+            {
+                xmlHashTablePtr seen = xmlHashCreate(8);
+                valRecordLocals = xmlHashCreate(8);
+                valAddSchemaLocals(BAD_CAST ops.schema, NULL, seen);
+                xmlHashFree(seen, NULL);
+            }
+#endif
             schemaCtxt = xmlSchemaNewValidCtxt(schema);
             if (!schemaCtxt)
             {
@@ -405,68 +2846,182 @@ valMain(int argc, char **argv)
         }
 #endif  /* LIBXML_SCHEMAS_ENABLED */
 
+        if (ops.embed) options |= XML_PARSE_DTDVALID;
+        key = valCacheEndSchemas(&ops, options);
+        if (!ops.schema && !ops.relaxng && !ops.schemaMap && !ops.embed)
+            wfCtxt = valNewWellFormedCtxt(&ops);
+
         for (i=start; i<argc; i++)
         {
             int failed = 0;
-            if (ops.embed) options |= XML_PARSE_DTDVALID;
+            FileMap map;
+            int mapped;
+            int buffered = 0;
+            int opened = 0;           /* the parser read this file */
+            int cached = 0;
+            uint64_t content;
+            const FileMap *mem;
+            int records = -2;
+#ifdef LIBXML_SCHEMAS_ENABLED
+            xmlSchemaValidCtxtPtr fileSchemaCtxt = schemaCtxt;
+            xmlRelaxNGPtr fileRelaxng = relaxng;
+#endif  /* LIBXML_SCHEMAS_ENABLED */
 
-            if (!reader)
+            valReportBegin(&ops, argv[i]);
+            mapped = valCacheOpen(&ops, argv[i], &map);
+            if (mapped && valCacheLookup(&ops, key, &map, &content))
             {
-                reader = xmlReaderForFile(argv[i], NULL, options);
+                cached = 1;
+                fileMapClose(&map);
+                goto readerResult;
             }
-            else
+            mem = (mapped && valCacheParseMapped(&map))? &map : NULL;
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+            /* the root is read for the route, then again to validate:
+               standard input can only be read once, so keep it */
+            if (valRoutes && !mapped && !strcmp(argv[i], "-") &&
+                fileMapOpen(&map, argv[i]) == 0)
+            {
+                buffered = 1;
+                mem = &map;
+            }
+            if (valRoutes)
             {
-                failed = xmlReaderNewFile(reader, argv[i], NULL, options);
+                valMapSchema *ms = NULL;
+
+                if (valRoute(&peek, argv[i], mem, &ms, ops.err) == 0)
+                {
+                    failed = 1;
+                    invalidFound = 1;
+                    if (mapped || buffered) fileMapClose(&map);
+                    goto readerResult;
+                }
+                fileSchemaCtxt = ms? ms->validCtxt : NULL;
+                fileRelaxng = ms? ms->relaxng : NULL;
             }
+#endif  /* LIBXML_SCHEMAS_ENABLED */
 
-            errorInfo.xmlReader = reader;
+            if (mapped)
+            {
+                xmlBufferEmpty(deps);
+                valDepsUncacheable = 0;
+                valDeps = deps;
+            }
             errorInfo.filename = argv[i];
+            if (wfCtxt)
+            {
+                failed = ops.splitParallel?
+                    valWellFormedParallel(argv[i], mem, options, ops.jobs,
+                        ops.err) : -2;
+                if (failed == -2)
+                    failed = valWellFormed(wfCtxt, argv[i], mem, options);
+                if (failed < 0)
+                {
+                    if (ops.err)
+                        fprintf(stderr, "couldn't read file '%s'\n", argv[i]);
+                    failed = 1; /* could not open file */
+                }
+                else
+                    opened = 1;
+            }
+            else
+            {
+                failed = valReaderOpen(&reader, argv[i], mem, options);
+                opened = !failed;
 
-            /* It makes no sense to continue if we are not reporting errors
-             * anyway. Note this doesn't apply to the --dtd case because the we
-             * can't stop there without aborting the whole program (and
-             * therefore we wouldn't be able to check multiple files).
-             */
-            if (!ops.err)
-                ops.stop = STOP;
+                errorInfo.xmlReader = reader;
 
-            if (reader && !failed)
-            {
-#ifdef LIBXML_SCHEMAS_ENABLED
-                if (schemaCtxt)
+                /* It makes no sense to continue if we are not reporting
+                 * errors anyway. Note this doesn't apply to the --dtd case
+                 * because the we can't stop there without aborting the whole
+                 * program (and therefore we wouldn't be able to check
+                 * multiple files).
+                 */
+                if (!ops.err && !ops.report)
+                    ops.stop = STOP;
+
+#if defined(LIBXML_SCHEMAS_ENABLED) && defined(HAVE_PTHREAD)
+                if (reader && !failed && ops.recordPattern && schema &&
+                    ops.jobs > 1 && !valRecordWhole)
                 {
-                    failed = xmlTextReaderSchemaValidateCtxt(reader,
-                        schemaCtxt, 0);
+                    records = valRecordParallel(reader, schema,
+                        ops.recordPattern, ops.jobs, ops.embed, &errorInfo);
+                    /* start over, validating the document as a whole */
+                    if (records == -2)
+                        failed = valReaderOpen(&reader, argv[i], mem,
+                            options);
                 }
-                else if (relaxng)
+#endif
+
+                if (records != -2)
                 {
-                    failed = xmlTextReaderRelaxNGSetSchema(reader,
-                        relaxng);
+                    failed = records;
                 }
+                else if (reader && !failed)
+                {
+                    int validating = ops.embed;
+#ifdef LIBXML_SCHEMAS_ENABLED
+                    if (valRoutes)
+                    {
+                        /* the reader keeps the previous document's schema */
+                        xmlTextReaderSchemaValidateCtxt(reader, NULL, 0);
+                        xmlTextReaderRelaxNGSetSchema(reader, NULL);
+                    }
+                    if (fileSchemaCtxt)
+                    {
+                        failed = xmlTextReaderSchemaValidateCtxt(reader,
+                            fileSchemaCtxt, 0);
+                        validating = 1;
+                    }
+                    else if (fileRelaxng)
+                    {
+                        failed = xmlTextReaderRelaxNGSetSchema(reader,
+                            fileRelaxng);
+                        validating = 1;
+                    }
 #endif  /* LIBXML_SCHEMAS_ENABLED */
 
-                if (failed == 0)
-                {
-                    int more_nodes;
-                    int validating = (schema || relaxng || ops.embed);
-                    do
+                    if (failed == 0)
                     {
-                        more_nodes = xmlTextReaderRead(reader);
-                        failed =
-                            (more_nodes == -1)? 1 :
-                            (!validating)? 0 :
-                            xmlTextReaderIsValid(reader) != 1;
-                    } while (more_nodes == 1 && (!failed || !ops.stop));
+                        int more_nodes;
+                        do
+                        {
+                            more_nodes = xmlTextReaderRead(reader);
+                            if (valReportCur && more_nodes == 1 &&
+                                xmlTextReaderNodeType(reader) ==
+                                    XML_READER_TYPE_ELEMENT)
+                                valReportCur->elements++;
+                            failed =
+                                (more_nodes == -1)? 1 :
+                                (!validating)? 0 :
+                                xmlTextReaderIsValid(reader) != 1;
+                        } while (more_nodes == 1 && (!failed || !ops.stop));
+                    }
+                }
+                else
+                {
+                    if (ops.err)
+                        fprintf(stderr, "couldn't read file '%s'\n",
+                            errorInfo.filename);
+                    failed = 1; /* could not open file */
                 }
             }
-            else
+            valDeps = NULL;
+            if (mapped)
             {
-                if (ops.err)
-                    fprintf(stderr, "couldn't read file '%s'\n", errorInfo.filename);
-                failed = 1; /* could not open file */
+                if (!failed && !valDepsUncacheable)
+                    valCacheStore(&ops, key, &map, content, deps);
+                fileMapClose(&map);
             }
+            if (buffered) fileMapClose(&map);
             if (failed) invalidFound = 1;
 
+        readerResult:
+            /* the parser is the previous file's if this one wasn't read */
+            valReportEnd(failed, cached, !opened? 0 :
+                wfCtxt? xmlByteConsumed(wfCtxt) :
+                reader? xmlTextReaderByteConsumed(reader) : 0);
             if (!ops.show_val_res)
             {
                 if ((ops.listGood > 0) && !failed)
@@ -484,17 +3039,29 @@ valMain(int argc, char **argv)
         }
         errorInfo.xmlReader = NULL;
         xmlFreeTextReader(reader);
+        if (wfCtxt) xmlFreeParserCtxt(wfCtxt);
 
 #ifdef LIBXML_SCHEMAS_ENABLED
     schemaCleanup:
+        xmlFreeTextReader(peek);
+        if (valRoutes) valFreeSchemaMap();
         xmlSchemaFreeValidCtxt(schemaCtxt);
         xmlRelaxNGFree(relaxng);
         xmlSchemaFree(schema);
+#ifdef HAVE_PTHREAD
+        xmlHashFree(valRecordLocals, NULL);
+        valRecordLocals = NULL;
+        valRecordWhole = 0;
+#endif
         xmlRelaxNGCleanupTypes();
         xmlSchemaCleanupTypes();
 #endif  /* LIBXML_SCHEMAS_ENABLED */
     }
 
+    if (ops.report && valReportWrite(&ops) != 0 && !invalidFound)
+        invalidFound = EXIT_BAD_FILE;
+    if (deps) xmlBufferFree(deps);
+    if (valDefaultLoader) xmlSetExternalEntityLoader(valDefaultLoader);
     xmlCleanupParser();
     return invalidFound;
 }
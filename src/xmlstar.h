@@ -50,6 +50,7 @@ void registerXstarNs(xmlXPathContextPtr ctxt);
 
 extern const xmlChar *default_ns;
 
+#define MAX_NS_ARGS    256
 int parseNSArr(xmlChar** ns_arr, int* plen, int argc, char **argv);
 void cleanupNSArr(xmlChar **ns_arr);
 extern xmlChar *ns_arr[];
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Time c14n of a document subset: the elements and texts of generated
+# records, selected by an XPath file, so that the visibility check runs
+# for every node against a large node set.  (A union in the XPath, such
+# as "//. | //@*", is itself quadratic in libxml2 and would be timed
+# instead.)
+#
+# usage: bench-c14n-subset.sh [<xmlstarlet-binary> [<records> [<runs>]]]
+
+XMLSTARLET=${1:-$PWD/xml}
+RECORDS=${2:-100000}
+RUNS=${3:-3}
+
+doc=${TMPDIR:-/tmp}/bench-c14n-subset.$$.xml
+xpath=${TMPDIR:-/tmp}/bench-c14n-subset.$$.xpath
+trap 'rm -f "$doc" "$xpath"' 0 1 2 15
+{
+    echo '<records xmlns="urn:records" xmlns:r="urn:ref">'
+    ${AWK:-awk} -v n="$RECORDS" 'BEGIN {
+        for (i = 0; i < n; i++)
+            printf "<rec id=\"%d\" r:type=\"t%d\"><name>record %d</name>" \
+                "<value>%d</value><!-- c --></rec>\n", i, i % 7, i, i * 7
+    }'
+    echo '</records>'
+} > "$doc"
+echo '<XPath>//node()[not(self::comment())]</XPath>' > "$xpath"
+
+echo "`wc -c < "$doc"` bytes"
+run=1
+while [ $run -le $RUNS ]; do
+    start=`date +%s%N`
+    "$XMLSTARLET" c14n --with-comments "$doc" "$xpath" > /dev/null
+    end=`date +%s%N`
+    echo "`expr \( $end - $start \) / 1000000` ms"
+    run=`expr $run + 1`
+done
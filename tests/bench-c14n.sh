@@ -0,0 +1,34 @@
+#!/bin/sh
+# Time c14n of a whole generated document, inclusive and exclusive, with
+# namespaces declared at the root and on every record.
+#
+# usage: bench-c14n.sh [<xmlstarlet-binary> [<records> [<runs>]]]
+
+XMLSTARLET=${1:-$PWD/xml}
+RECORDS=${2:-500000}
+RUNS=${3:-3}
+
+doc=${TMPDIR:-/tmp}/bench-c14n.$$.xml
+trap 'rm -f "$doc"' 0 1 2 15
+{
+    echo '<records xmlns="urn:records" xmlns:r="urn:ref">'
+    ${AWK:-awk} -v n="$RECORDS" 'BEGIN {
+        for (i = 0; i < n; i++)
+            printf "<rec id=\"%d\" r:type=\"t%d\"><name>record %d</name>" \
+                "<v:value xmlns:v=\"urn:v\">%d &amp; %d</v:value>" \
+                "<!-- c --></rec>\n", i, i % 7, i, i * 7, i
+    }'
+    echo '</records>'
+} > "$doc"
+
+echo "`wc -c < "$doc"` bytes"
+for mode in --with-comments --exc-with-comments; do
+    run=1
+    while [ $run -le $RUNS ]; do
+        start=`date +%s%N`
+        "$XMLSTARLET" c14n $mode "$doc" > /dev/null
+        end=`date +%s%N`
+        echo "$mode: `expr \( $end - $start \) / 1000000` ms"
+        run=`expr $run + 1`
+    done
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Measure throughput of well-formedness checking (val -w), reported by
+# val --report, on the bigxml test document grown with generated records.
+#
+# usage: bench-well-formed.sh [<xmlstarlet-binary> [<records> [<runs>]]]
+
+XMLSTARLET=${1:-$PWD/xml}
+RECORDS=${2:-300000}
+RUNS=${3:-3}
+
+cd "${srcdir:-.}"/examples || exit 1
+. ./bigxml
+
+doc=${TMPDIR:-/tmp}/bench-well-formed.$$.xml
+trap 'rm -f "$doc"' 0 1 2 15
+{
+    xmldoc '<records>' | ${SED:-sed} '$d'
+    ${AWK:-awk} -v n="$RECORDS" 'BEGIN {
+        for (i = 0; i < n; i++)
+            printf "<rec id=\"%d\" type=\"t%d\"><name>record %d</name>" \
+                "<value>%d &amp; more</value><!-- c --></rec>\n",
+                i, i % 7, i, i * 7
+    }'
+    echo '</records>'
+    echo '</root>'
+} > "$doc"
+
+echo "`wc -c < "$doc"` bytes"
+run=1
+while [ $run -le $RUNS ]; do
+    "$XMLSTARLET" val -q --report json - "$doc" \
+        | ${SED:-sed} -n 's/.*"mb_per_second": \([0-9.]*\).*/\1 MB\/s/p'
+    run=`expr $run + 1`
+done
@@ -11,7 +11,10 @@ bigxml-relaxng
 bigxml-well-formed
 bigxml-xsd
 c14n-default-attr
+c14n-digest
+c14n-namespaces
 c14n-newlines
+c14n-subset-ns
 c14n1
 c14n2
 command-help
@@ -30,22 +33,35 @@ ed-backref-delete
 ed-backref1
 ed-backref2
 ed-expr
+ed-fused
 ed-insert
+ed-insert-xml
 ed-literal
 ed-move
 ed-namespace
 ed-nop
+ed-patch-out
 ed-subnode
+ed-variant
+ed-xupdate
 elem1
 elem2
 elem3
 elem-depth
+elem-infer
+elem-pattern
+elem-stats
 elem-uniq
+elem-uniq-files
 escape1
 exslt-ed
 exslt1
 external-entity
 findfile1
+format-check
+format-files
+format-minify
+format-mixed
 genxml1
 hello1
 localname1
@@ -81,12 +97,21 @@ table3
 unicode1
 update-attr1
 update-elem1
+val-cache
+val-dtd-cond
+val-dtd-entities
+val-dtd-prefixed
+val-embed-shared
+val-record-parallel
+val-report
+val-schema-map
+val-split-parallel
 valid1
 xinclude1
 xsl-param1
 xsl-sum1'
 
-XFAIL_TESTS='bigxml-dtd|ed-namespace'
+XFAIL_TESTS='ed-namespace'
 
 
 testdir=`dirname $0`
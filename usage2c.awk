@@ -23,14 +23,17 @@ length(command_name) == 0 {
 { gsub(/%/, "%%"); }
 
 # white space separted instances of PROG will be replaced with the final name of
-# the xmlstarlet executable
+# the xmlstarlet executable; rebuilding the line loses its indent, put it back
 /PROG/ {
+    match($0, /^[ \t]*/);
+    indent = substr($0, 1, RLENGTH);
     for (i = 1; i <= NF; i++) {
         if ($i == "PROG") {
             progs++;
             $i = "%s";
         }
     }
+    $0 = indent $0;
 }
 
 # C-preprocessor directives are unchanged